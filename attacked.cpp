@@ -26,8 +26,10 @@
 
 #include "board.h"
 #include "functions.h"
+#include "profile.h"
 
-bool IsAttacked(struct Board * b, int side, int square)
+template <int side>
+static inline bool Attacked(struct Board * b, int square, uint64_t occ)
 {
     uint64_t pawns, knights, bishopsqueens, rooksqueens, kings;
 
@@ -41,10 +43,147 @@ bool IsAttacked(struct Board * b, int side, int square)
     if (KingAttacks(square) & kings) return true;
 
     bishopsqueens = (b->pieces[BISHOP] | b->pieces[QUEEN]) & b->colors[side];
-    if (BishopAttacks(square, (b->colors[WHITE] | b->colors[BLACK])) & bishopsqueens) return true;
+    if (BishopAttacks(square, occ) & bishopsqueens) return true;
 
     rooksqueens = (b->pieces[ROOK] | b->pieces[QUEEN]) & b->colors[side];
-    if (RookAttacks(square, (b->colors[WHITE] | b->colors[BLACK])) & rooksqueens) return true;
+    if (RookAttacks(square, occ) & rooksqueens) return true;
+
+    return false;
+}
+
+bool IsAttacked(struct Board * b, int side, int square)
+{
+    PROFILE_ZONE(ZONE_IS_ATTACKED);
+
+    uint64_t occ = b->colors[WHITE] | b->colors[BLACK];
+
+    return (side == WHITE) ? Attacked<WHITE>(b, square, occ) : Attacked<BLACK>(b, square, occ);
+}
+
+// As IsAttacked(), with some pieces taken off the board, such as a king
+// that is about to move along a slider's line.
+bool IsAttackedBy(struct Board * b, int side, int square, uint64_t occ)
+{
+    return (side == WHITE) ? Attacked<WHITE>(b, square, occ) : Attacked<BLACK>(b, square, occ);
+}
+
+// The enemy pieces giving check to the side to move.
+uint64_t Checkers(struct Board * b)
+{
+    int side = !b->side;
+    int square = lsb(b->pieces[KING] & b->colors[b->side]);
+    uint64_t occ = b->colors[WHITE] | b->colors[BLACK];
+    uint64_t attackers;
+
+    attackers  = PawnAttacks(!side, square) & b->pieces[PAWN];
+    attackers |= KnightAttacks(square) & b->pieces[KNIGHT];
+    attackers |= BishopAttacks(square, occ) & (b->pieces[BISHOP] | b->pieces[QUEEN]);
+    attackers |= RookAttacks(square, occ) & (b->pieces[ROOK] | b->pieces[QUEEN]);
+
+    return attackers & b->colors[side];
+}
+
+// Pieces that are alone on a line between a king and an enemy slider.
+// Those of the king's own side are pinned, and their sliders go in pinners;
+// those of the slider's side give discovered check when they move.
+uint64_t SliderBlockers(struct Board * b, int king, uint64_t sliders, uint64_t * pinners)
+{
+    uint64_t occ = b->colors[WHITE] | b->colors[BLACK];
+    uint64_t own = ((b->colors[WHITE] >> king) & 1) ? b->colors[WHITE] : b->colors[BLACK];
+    uint64_t snipers, between, blockers = 0;
+    int sq;
+
+    snipers = (RookAttacks(king, 0) & (b->rooks() | b->queens())) |
+              (BishopAttacks(king, 0) & (b->bishops() | b->queens()));
+    snipers &= sliders;
+
+    *pinners = 0;
+
+    while (snipers) {
+        sq = lsb(snipers);
+
+        between = Between(king, sq) & occ;
+
+        if (between && !(between & (between - 1))) {
+            blockers |= between;
+
+            if (between & own)
+                *pinners |= 1ULL << sq;
+        }
+
+        snipers &= snipers - 1;
+    }
+
+    return blockers;
+}
+
+// Where each kind of piece of the side to move would check the enemy king,
+// and which of its pieces would uncover a check by moving away.
+void InitCheckInfo(struct Board * b, struct CheckInfo * ci)
+{
+    uint64_t occ = b->colors[WHITE] | b->colors[BLACK];
+    uint64_t pinners;
+
+    ci->king = lsb(b->kings() & b->colors[!b->side]);
+
+    ci->squares[PAWN]   = PawnAttacks(!b->side, ci->king);
+    ci->squares[KNIGHT] = KnightAttacks(ci->king);
+    ci->squares[BISHOP] = BishopAttacks(ci->king, occ);
+    ci->squares[ROOK]   = RookAttacks(ci->king, occ);
+    ci->squares[QUEEN]  = ci->squares[BISHOP] | ci->squares[ROOK];
+    ci->squares[KING]   = 0;
+
+    ci->discovered = SliderBlockers(b, ci->king, b->colors[b->side], &pinners) & b->colors[b->side];
+}
+
+// Does a pseudo-legal move check the enemy king? The board is the one
+// before the move, and the check info has to belong to it.
+bool GivesCheck(struct Board * b, struct CheckInfo * ci, struct Move m)
+{
+    int from = m.from, dest = m.dest, type = m.type();
+    int capsq, rookfrom, rookdest;
+    uint64_t occ = b->colors[WHITE] | b->colors[BLACK];
+    uint64_t ours = b->colors[b->side];
+
+    // Direct check
+    if (m.prom() == NO_PIECE && (ci->squares[b->squares[from]] & (1ULL << dest)))
+        return true;
+
+    // Discovered check, unless the piece stays on the line to the king
+    if ((ci->discovered & (1ULL << from)) &&
+            !(Between(ci->king, dest) & (1ULL << from)) &&
+            !(Between(ci->king, from) & (1ULL << dest)))
+        return true;
+
+    // The promoted piece may check through the square the pawn left.
+    if (m.prom() != NO_PIECE) {
+        occ ^= 1ULL << from;
+
+        switch (m.prom()) {
+        case KNIGHT: return (KnightAttacks(dest) >> ci->king) & 1;
+        case BISHOP: return (BishopAttacks(dest, occ) >> ci->king) & 1;
+        case ROOK:   return (RookAttacks(dest, occ) >> ci->king) & 1;
+        case QUEEN:  return (QueenAttacks(dest, occ) >> ci->king) & 1;
+        }
+    }
+
+    // Removing both pawns may open a line.
+    if (type == ENPASSANT) {
+        capsq = (b->side == WHITE) ? dest - 8 : dest + 8;
+        occ ^= (1ULL << from) | (1ULL << capsq) | (1ULL << dest);
+
+        return (RookAttacks(ci->king, occ) & (b->rooks() | b->queens()) & ours) ||
+               (BishopAttacks(ci->king, occ) & (b->bishops() | b->queens()) & ours);
+    }
+
+    // The rook may check from its new square.
+    if (type == CASTLE) {
+        rookfrom = (dest > from) ? from + 3 : from - 4;
+        rookdest = (dest > from) ? from + 1 : from - 1;
+        occ ^= (1ULL << from) | (1ULL << dest) | (1ULL << rookfrom) | (1ULL << rookdest);
+
+        return (RookAttacks(rookdest, occ) >> ci->king) & 1;
+    }
 
     return false;
 }
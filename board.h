@@ -25,14 +25,25 @@
 #ifndef BOARD_H
 #define BOARD_H
 
-#include <array>
 
 #include <inttypes.h>
 #include <stdio.h>
 
+#include <atomic>
+
+#define NNUE_HIDDEN 256
+#define NNUE_L2     32
+#define NNUE_L3     32
+
+// Each side's first network layer, kept up to date as moves are made.
+struct Accumulator {
+    int16_t values[2][NNUE_HIDDEN];
+};
+
 struct Board {
     uint64_t pieces[6];
     uint64_t colors[2];
+    unsigned char squares[64]; // Piece type on each square, or NO_PIECE
     unsigned char side;
     unsigned char castle;
     unsigned char ep;
@@ -48,44 +59,167 @@ struct Board {
     uint64_t kings() const;
 };
 
+enum { WHITE, BLACK, FORCE };
+enum { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING, NO_PIECE };
+enum { QUIET, CASTLE, CAPTURE, ENPASSANT, PROMOTION, CAPTURE_PROMOTION, DOUBLE_PUSH };
+
+// A move packed into 16 bits. The moving piece and its colour are found on
+// the board. Promotions set the top bit of the flags, captures among them
+// the next bit, and the low two bits hold the promoted piece.
 struct Move {
-    unsigned char from:6;
-    unsigned char dest:6;
-    unsigned char type:3;
-    unsigned char prom:3;
-    unsigned char color:1;
-    unsigned char piece:3;
-    signed short  score:12;
+    uint16_t from:6;
+    uint16_t dest:6;
+    uint16_t flags:4;
     constexpr Move():
-        from(0), dest(0), type(0), prom(0), color(0), piece(0), score(0)
+        from(0), dest(0), flags(0)
         {}
-    constexpr Move(char f, char d, char t, char p, char c, char i, short s):
-        from(f), dest(d), type(t), prom(p), color(c), piece(i), score(s)
+    constexpr Move(int f, int d, int t, int p = NO_PIECE):
+        from(f), dest(d),
+        flags(t == PROMOTION ? 8 + p - KNIGHT : t == CAPTURE_PROMOTION ? 12 + p - KNIGHT : t)
         {}
-    constexpr bool operator<(const Move& m)
+    constexpr int type() const
     {
-        return score > m.score;
+        return (flags & 8) ? ((flags & 4) ? CAPTURE_PROMOTION : PROMOTION) : flags;
+    }
+    constexpr int prom() const
+    {
+        return (flags & 8) ? KNIGHT + (flags & 3) : NO_PIECE;
+    }
+    constexpr bool operator==(const Move& m) const
+    {
+        return from == m.from && dest == m.dest && flags == m.flags;
+    }
+    constexpr bool operator!=(const Move& m) const
+    {
+        return !(*this == m);
     }
 };
 
+static_assert(sizeof(Move) == 2, "moves must pack into 16 bits");
+
 struct Undo {
+    uint64_t hash;
     char ep;
     char cap;
     char castle;
+    char fifty;
 };
 
+// A piece moved, added (from INVALID) or removed (to INVALID) by a move.
+struct DirtyPiece {
+    char color, piece, from, dest;
+};
+
+// Precomputed per node, so that moves can be tested for check unplayed.
+struct CheckInfo {
+    uint64_t squares[6];
+    uint64_t discovered;
+    int king;
+};
+
+// A node's move list, a slice of its search context's move stack.
 struct Sort {
-    char state;
-    std::array<Move, 128> m;
+    struct Move * m;
+    int16_t * score;
     int movecount;
     int i;
 };
 
+#define MAX_PLY 128
+
+// No chess position has more than 218 legal moves, nor this many pseudo-legal ones.
+#define MAX_MOVES 256
+
 struct PV {
     int count;
-    struct Move moves[64];
+    struct Move moves[MAX_PLY];
+};
+#define MAX_GAME 1024
+
+// Zobrist keys of the game so far, used to detect repetitions.
+struct KeyStack {
+    uint64_t keys[MAX_GAME + MAX_PLY];
+    int count;
+};
+
+// Time allocation and iteration history for one search.
+struct Clock {
+    int starttime, timelimit, hardtimelimit;
+    int optimum;
+    int lastend, lastiter, previter;
+    int stable, lastscore;
+    struct Move lastbest;
+};
+
+// Forward pruning switches and margins, tunable through xboard options.
+struct SearchParams {
+    int rfp, rfp_depth, rfp_margin;       // Reverse futility pruning
+    int fut, fut_depth, fut_margin;       // Futility pruning
+    int razor, razor_depth, razor_margin; // Razoring
+    int lmp, lmp_depth, lmp_count;        // Late move pruning
+    int see, see_depth, see_margin;       // SEE pruning
+    int delta, delta_margin;              // Quiescence delta pruning
+    int qsee;                             // Quiescence SEE pruning
+    int qchecks;                          // Quiet checks at the first quiescence ply
+};
+
+// A transposition table: allocated, or mapped from a hash file, in which
+// case mapbase and maplength describe the whole mapping. The generation
+// advances with each search, to tell its entries from stale ones.
+struct TTE;
+
+struct HashTable {
+    struct TTE * entries;
+    size_t size;
+    void * mapbase;
+    size_t maplength;
+    uint8_t generation;
+};
+
+// Per-ply search state.
+struct SearchStack {
+#ifdef COPYMAKE
+    struct Board board;
+#endif
+    int eval;
+    struct Move move;
+    int first;  // Start of this ply's slice of the move stack
+};
+
+// Everything a single search owns, so that searches can run side by side.
+struct SearchContext {
+    struct Board b;
+    struct SearchParams params;
+    struct HashTable * tt;
+    int nodelimit;  // Stop after this many nodes, unless 0
+    int multipv;    // Number of best lines to find at the root
+    struct SearchStack stack[MAX_PLY];
+    // The network's accumulators for the board at each ply, only kept up
+    // to date while the network is in use.
+    struct Accumulator acc[MAX_PLY];
+    // Move lists of the current line, each ply's after its parent's.
+    struct Move moves[MAX_PLY * MAX_MOVES];
+    int16_t scores[MAX_PLY * MAX_MOVES];
+    // Triangular PV table: row ply holds the best line from ply onwards
+    // in columns ply to pvlen[ply]-1.
+    struct Move pv[MAX_PLY][MAX_PLY];
+    int pvlen[MAX_PLY];
+    // Root moves left out of the search, as they head lines already found.
+    struct Move excluded[MAX_MOVES];
+    int excludedcount;
+    struct Clock clock;
+    struct KeyStack keys;
+    int history[2][64][64];
+    int nodes, qnodes;
+    int first, cuts;
+    // Set by the search itself, or by the main thread to end a ponder search.
+    std::atomic<int> stop;
+    // A ponder hit posts the real clock here for the searching thread to take up.
+    struct Clock hitclock;
+    std::atomic<bool> ponderhit;
 };
 
+
 #define COL(x) ((x)&7)
 #define ROW(x) ((x)>>3)
 
@@ -93,10 +227,8 @@ struct PV {
 
 #define MATE 10000
 
-enum { WHITE, BLACK, FORCE };
-enum { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING, NO_PIECE };
-enum { QUIET, CASTLE, CAPTURE, ENPASSANT, PROMOTION, CAPTURE_PROMOTION, DOUBLE_PUSH };
 enum { TT, CAPTURES, QUIETS };
+enum { PST_SCALAR, PST_AVX2, PST_AVX512, PST_KERNELS };
 
 static const uint64_t FileAMask = 0x0101010101010101ULL;
 static const uint64_t FileBMask = 0x0202020202020202ULL;
@@ -120,10 +252,8 @@ static const uint64_t Rank8Mask = 0xFF00000000000000ULL;
 extern const int piecevals[7][2];
 extern const int pst[6][2][64];
 
-extern int nodes;
-extern int first, cuts;
-
-extern int stopsearch;
+extern struct SearchParams params;
+extern struct HashTable tt;
 
 extern int bias;
 
@@ -132,7 +262,10 @@ extern uint64_t zobrist_side;
 extern uint64_t zobrist_castle[16];
 extern uint64_t zobrist_ep[8];
 
-extern int starttime, timelimit, hardtimelimit;
+extern int moveoverhead;
+extern int usennue;
+extern int pstkernel;
+extern int multipv;
 
 #define PRINT_MOVE(m) PrintMove(b, m)
 
@@ -146,10 +279,10 @@ static inline void PrintMove(struct Board *, struct Move m)
         'p', 'n', 'b', 'r', 'q', 'k'
     };
 
-    printf("%c%d%c%d", 'a' + COL (((m).from)&63), 1 + ROW (((m).from)&63), 'a' + COL (((m).dest)&63), 1 + ROW (((m).dest)&63));
+    printf("%c%d%c%d", 'a' + COL(m.from), 1 + ROW(m.from), 'a' + COL(m.dest), 1 + ROW(m.dest));
 
-    if (m.type == PROMOTION || m.type == CAPTURE_PROMOTION) {
-        printf("%c", promotechar[m.prom]);
+    if (m.prom() != NO_PIECE) {
+        printf("%c", promotechar[m.prom()]);
     }
 }
 
@@ -24,8 +24,14 @@
 
 #include <stdint.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PST_X86
+#endif
+
 #include "board.h"
 #include "functions.h"
+#include "profile.h"
 
 const int piecevals[7][2] = { {105, 105}, {342, 342}, {347, 347}, {560, 560}, {1085, 1085}, {20000, 20000}, {0, 0} };
 const int pst[6][2][64] = {
@@ -203,8 +209,152 @@ void EvalPST(struct Board * b, int& midgame, int& endgame)
     }
 }
 
+// The PST with black's half flipped and negated, so that a full sum over
+// all twelve piece bitboards is a plain masked add. Filled from pst.
+alignas(64) static int16_t psttab[2][6][2][64];
+
+static const char * pstkernelnames[PST_KERNELS] = { "scalar", "avx2", "avx512bw" };
+
+#ifdef PST_X86
+// Expand each bitboard 16 squares at a time into word masks: every word
+// picks the byte holding its square, then tests its bit.
+__attribute__((target("avx2")))
+static void EvalPSTAVX2(struct Board * b, int& midgame, int& endgame)
+{
+    const __m256i bits = _mm256_setr_epi8(1, 1, 2, 2, 4, 4, 8, 8, 16, 16, 32, 32, 64, 64, -128, -128,
+                                          1, 1, 2, 2, 4, 4, 8, 8, 16, 16, 32, 32, 64, 64, -128, -128);
+    __m256i select[4];
+    __m256i mg = _mm256_setzero_si256(), eg = _mm256_setzero_si256();
+    uint64_t piecebb;
+    int color, piece, chunk;
+
+    for (chunk = 0; chunk < 4; chunk++)
+        select[chunk] = _mm256_setr_epi8(2*chunk,     2*chunk,     2*chunk,     2*chunk,
+                                         2*chunk,     2*chunk,     2*chunk,     2*chunk,
+                                         2*chunk,     2*chunk,     2*chunk,     2*chunk,
+                                         2*chunk,     2*chunk,     2*chunk,     2*chunk,
+                                         2*chunk + 1, 2*chunk + 1, 2*chunk + 1, 2*chunk + 1,
+                                         2*chunk + 1, 2*chunk + 1, 2*chunk + 1, 2*chunk + 1,
+                                         2*chunk + 1, 2*chunk + 1, 2*chunk + 1, 2*chunk + 1,
+                                         2*chunk + 1, 2*chunk + 1, 2*chunk + 1, 2*chunk + 1);
+
+    for (color = WHITE; color <= BLACK; color++) {
+        for (piece = PAWN; piece <= KING; piece++) {
+            piecebb = b->pieces[piece] & b->colors[color];
+
+            if (!piecebb)
+                continue;
+
+            __m256i bb = _mm256_set1_epi64x(piecebb);
+
+            for (chunk = 0; chunk < 4; chunk++) {
+                if (!((piecebb >> (16*chunk)) & 0xFFFF))
+                    continue;
+
+                __m256i mask = _mm256_and_si256(_mm256_shuffle_epi8(bb, select[chunk]), bits);
+                // Both bytes of a word test the same bit.
+                mask = _mm256_cmpeq_epi8(mask, bits);
+                mg = _mm256_add_epi16(mg, _mm256_and_si256(mask,
+                         _mm256_load_si256((const __m256i *)&psttab[color][piece][0][16*chunk])));
+                eg = _mm256_add_epi16(eg, _mm256_and_si256(mask,
+                         _mm256_load_si256((const __m256i *)&psttab[color][piece][1][16*chunk])));
+            }
+        }
+    }
+
+    // Each lane holds at most four squares' worth, so 16 bits can't
+    // overflow; widen before summing the lanes.
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_hadd_epi32(_mm256_madd_epi16(mg, ones), _mm256_madd_epi16(eg, ones));
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_hadd_epi32(s, s);
+
+    midgame += _mm_extract_epi32(s, 0);
+    endgame += _mm_extract_epi32(s, 1);
+}
+
+// With AVX-512 the bitboard halves are the masks themselves.
+__attribute__((target("avx512f,avx512bw")))
+static void EvalPSTAVX512(struct Board * b, int& midgame, int& endgame)
+{
+    __m512i mg = _mm512_setzero_si512(), eg = _mm512_setzero_si512();
+    uint64_t piecebb;
+    int color, piece;
+
+    for (color = WHITE; color <= BLACK; color++) {
+        for (piece = PAWN; piece <= KING; piece++) {
+            piecebb = b->pieces[piece] & b->colors[color];
+
+            if (!piecebb)
+                continue;
+
+            mg = _mm512_add_epi16(mg, _mm512_maskz_loadu_epi16((__mmask32)piecebb, &psttab[color][piece][0][0]));
+            mg = _mm512_add_epi16(mg, _mm512_maskz_loadu_epi16((__mmask32)(piecebb >> 32), &psttab[color][piece][0][32]));
+            eg = _mm512_add_epi16(eg, _mm512_maskz_loadu_epi16((__mmask32)piecebb, &psttab[color][piece][1][0]));
+            eg = _mm512_add_epi16(eg, _mm512_maskz_loadu_epi16((__mmask32)(piecebb >> 32), &psttab[color][piece][1][32]));
+        }
+    }
+
+    const __m512i ones = _mm512_set1_epi16(1);
+
+    midgame += _mm512_reduce_add_epi32(_mm512_madd_epi16(mg, ones));
+    endgame += _mm512_reduce_add_epi32(_mm512_madd_epi16(eg, ones));
+}
+#endif
+
+// The scalar loop is the default, as it beats the AVX2 kernel; the vector
+// kernels can be chosen through the PST Kernel option.
+int pstkernel = PST_SCALAR;
+
+bool PSTKernelSupported(int kernel)
+{
+    switch (kernel) {
+    case PST_SCALAR:
+        return true;
+#ifdef PST_X86
+    case PST_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case PST_AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    }
+
+    return false;
+}
+
+bool SetPSTKernel(int kernel)
+{
+    if (kernel < 0 || kernel >= PST_KERNELS || !PSTKernelSupported(kernel))
+        return false;
+
+    pstkernel = kernel;
+    return true;
+}
+
+const char * PSTKernelName(int kernel)
+{
+    return pstkernelnames[kernel];
+}
+
+// Derive the vector tables from pst.
+void InitEval()
+{
+    int piece, phase, sq;
+
+    for (piece = PAWN; piece <= KING; piece++) {
+        for (phase = 0; phase < 2; phase++) {
+            for (sq = 0; sq < 64; sq++) {
+                psttab[WHITE][piece][phase][sq] = pst[piece][phase][sq];
+                psttab[BLACK][piece][phase][sq] = -pst[piece][phase][sq^56];
+            }
+        }
+    }
+}
+
 int Eval(struct Board * b)
 {
+    PROFILE_ZONE(ZONE_EVAL);
+
     int midgame, endgame, phase, value;
 
     midgame = 0;
@@ -216,7 +366,19 @@ int Eval(struct Board * b)
 
     // PST
     // TODO: incremental update.
-    EvalPST(b, midgame, endgame);
+    switch (pstkernel) {
+#ifdef PST_X86
+    case PST_AVX512:
+        EvalPSTAVX512(b, midgame, endgame);
+        break;
+    case PST_AVX2:
+        EvalPSTAVX2(b, midgame, endgame);
+        break;
+#endif
+    default:
+        EvalPST(b, midgame, endgame);
+        break;
+    }
 
     // Tempo
     if (b->side == WHITE) {
@@ -26,6 +26,7 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "board.h"
 #include "functions.h"
@@ -42,6 +43,8 @@ void ClearBoard(struct Board * b)
     b->colors[WHITE] = 0;
     b->colors[BLACK] = 0;
 
+    memset(b->squares, NO_PIECE, sizeof(b->squares));
+
     b->side = FORCE;
 
     b->ep = INVALID;
@@ -123,21 +126,27 @@ void ParseFEN(struct Board * b, char * fen)
 
             if (c == 'p') {
                 b->pieces[PAWN] |= 1ULL << square;
+                b->squares[square] = PAWN;
             }
             if (c == 'n') {
                 b->pieces[KNIGHT] |= 1ULL << square;
+                b->squares[square] = KNIGHT;
             }
             if (c == 'b') {
                 b->pieces[BISHOP] |= 1ULL << square;
+                b->squares[square] = BISHOP;
             }
             if (c == 'r') {
                 b->pieces[ROOK] |= 1ULL << square;
+                b->squares[square] = ROOK;
             }
             if (c == 'q') {
                 b->pieces[QUEEN] |= 1ULL << square;
+                b->squares[square] = QUEEN;
             }
             if (c == 'k') {
                 b->pieces[KING] |= 1ULL << square;
+                b->squares[square] = KING;
             }
 
             file++;
@@ -217,22 +226,19 @@ void ParseFEN(struct Board * b, char * fen)
         b->ep = 8*rank + file;
     }
 
-    // Another space separator.
-    fenidx++;
+    // Another space separator, if anything follows at all.
+    if (fen[fenidx] == ' ')
+        fenidx++;
 
     // Fifty-move counter.
-    // A number between 0 and (hopefully) 99.
-    // This code breaks if we are given a fifty-move counter >= 100, but such
-    // positions are illegal anyway.
-    c = fen[fenidx];
-    fenidx++;
-
-    b->fifty = c - '0';
+    // EPD has operations where FEN has the move counters, so the counter
+    // is only read if there are digits here, and is 0 otherwise. Anything
+    // past 100 is a draw all the same, so it is capped there.
+    b->fifty = 0;
 
-    if (fen[fenidx] != ' ') {
-        b->fifty *= 10;
-        c = fen[fenidx];
-        b->fifty += c - '0';
+    while (fen[fenidx] >= '0' && fen[fenidx] <= '9') {
+        b->fifty = min(b->fifty * 10 + (fen[fenidx] - '0'), 100);
+        fenidx++;
     }
 
     // Next would be the fullmove counter, except we really don't care about it in the
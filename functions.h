@@ -58,10 +58,19 @@ static inline int min(int a, int b)
 
 // attacked.cpp
 extern bool IsAttacked(struct Board * b, int side, int square);
+extern bool IsAttackedBy(struct Board * b, int side, int square, uint64_t occ);
+extern uint64_t Checkers(struct Board * b);
+extern uint64_t SliderBlockers(struct Board * b, int king, uint64_t sliders, uint64_t * pinners);
+extern void InitCheckInfo(struct Board * b, struct CheckInfo * ci);
+extern bool GivesCheck(struct Board * b, struct CheckInfo * ci, struct Move m);
 extern bool IsIllegal(struct Board * b);
 extern bool IsInCheck(struct Board * b);
 
 // eval.cpp
+extern void InitEval();
+extern bool PSTKernelSupported(int kernel);
+extern bool SetPSTKernel(int kernel);
+extern const char * PSTKernelName(int kernel);
 extern int Eval(struct Board * b);
 
 // fen.cpp
@@ -74,6 +83,9 @@ extern int ReadClock();
 // makemove.cpp
 extern void MakeMove(struct Board * b, struct Undo * u, struct Move m);
 extern void UnmakeMove(struct Board * b, struct Undo * u, struct Move m);
+extern void MakeNullMove(struct Board * b, struct Undo * u);
+extern void UnmakeNullMove(struct Board * b, struct Undo * u);
+extern int DirtyPieces(struct Board * b, struct Undo * u, struct Move m, struct DirtyPiece * d);
 
 // magic.cpp
 extern void InitMagics();
@@ -83,37 +95,75 @@ extern uint64_t BishopAttacks(const int sq, const uint64_t occ);
 extern uint64_t RookAttacks(const int sq, const uint64_t occ);
 extern uint64_t QueenAttacks(const int sq, const uint64_t occ);
 extern uint64_t KingAttacks(const int sq);
+extern uint64_t Between(const int a, const int b);
 
 // movegen.cpp
 extern int GenerateQuiets(struct Board * b, struct Move * m, int movecount);
+extern int GenerateEvasions(struct Board * b, struct Move * m, int movecount);
+extern int GenerateQuietChecks(struct Board * b, struct CheckInfo * ci, struct Move * m, int movecount);
+extern int GenerateLegal(struct Board * b, struct Move * m, int movecount);
 extern int GenerateCaptures(struct Board * b, struct Move * m, int movecount);
 
 // movesort.cpp
-extern void InitSort(struct Board * b, struct Sort * s, struct Move ttm);
-extern void InitSortQuies(struct Board * b, struct Sort * s);
+extern void InitSort(struct Board * b, struct Sort * s, struct Move ttm, struct SearchContext * ctx, int ply);
+extern void InitSortQuies(struct Board * b, struct Sort * s, struct Move ttm, struct CheckInfo * ci, struct SearchContext * ctx, int ply);
 extern int NextMove(struct Sort * s, struct Move * m);
 extern int MoveValue(struct Board * b, struct Move m);
 
-extern void ClearHistory();
-extern void ReduceHistory();
-extern void UpdateHistory(struct Sort * s, int depth);
+extern void ClearHistory(struct SearchContext * ctx);
+extern void ReduceHistory(struct SearchContext * ctx);
+extern void UpdateHistory(struct SearchContext * ctx, int side, struct Move m, int depth);
+
+// nnue.cpp
+extern bool LoadNNUE(const char * path);
+extern bool NNUEActive();
+extern void RefreshNNUE(struct Board * b, struct Accumulator * acc);
+extern void UpdateNNUE(struct Board * b, struct DirtyPiece * d, int count, struct Accumulator * parent, struct Accumulator * acc);
+extern int EvalNNUE(struct Board * b, struct Accumulator * acc);
 
 // perft.cpp
 extern uint64_t Perft(struct Board * b, int depth);
 extern uint64_t Divide(struct Board * b, int depth);
+extern uint64_t PerftLegal(struct Board * b, int depth);
+extern int PerftSuite(const char * path, int threads);
+
+// profile.cpp
+extern void ProfileFlush();
+extern void ProfileReport();
 
 // search.cpp
-extern int Quies(struct Board * b, int alpha, int beta);
-extern int Search(struct Board * b, int depth, int alpha, int beta, int ply, struct PV * pv);
+extern void InitSearch(struct SearchContext * ctx, struct Board * b, struct KeyStack * game);
+extern int Quies(struct SearchContext * ctx, int alpha, int beta, int ply, int depth);
+extern int Think(struct SearchContext * ctx, int maxdepth, struct PV * pv, int post);
 
 // see.cpp
 extern int SEE(struct Board * b, int from, int to, int cap, int att);
+extern bool SeeGE(struct Board * b, struct Move m, int threshold);
+
+// selfplay.cpp
+extern void SelfPlay(const char * path, int games, int threads, int nodes, struct SearchParams * challenger,
+                     double elo0, double elo1);
+
+// timeman.cpp
+extern void StartClock(struct Clock * c, int timeleft, int movestogo, int inc);
+extern void StartClockInfinite(struct Clock * c);
+extern bool NextIteration(struct Clock * c, int depth, struct Move best, int score);
+extern bool HardTimeout(struct Clock * c);
+extern int Elapsed(struct Clock * c);
 
 // tt.cpp
-extern void ResizeTT(int megabytes);
-extern void ClearTT();
-extern int ReadTT(struct Board * b, struct Move * m, int depth, int alpha, int beta, int ply);
-extern void WriteTT(struct Board * b, int depth, int val, int hashf, struct Move m, int ply);
+extern void FreeTT(struct HashTable * t);
+extern void ResizeTT(struct HashTable * t, int megabytes);
+extern void ClearTT(struct HashTable * t);
+extern void AgeTT(struct HashTable * t);
+extern bool SaveTT(struct HashTable * t, const char * path);
+extern bool LoadTT(struct HashTable * t, const char * path, bool shared);
+extern int ReadTT(struct HashTable * t, struct Board * b, struct Move * m, int depth, int alpha, int beta, int ply);
+extern void WriteTT(struct HashTable * t, struct Board * b, int depth, int val, int hashf, struct Move m, int ply);
+extern struct Move ProbeTTMove(struct HashTable * t, struct Board * b);
+
+// tune.cpp
+extern void Tune(const char * path, int epochs, int threads);
 
 // zobrist.cpp
 extern void InitZobrist();
@@ -36,6 +36,7 @@ static uint64_t KnightMask[64];
 static uint64_t BishopMask[64];
 static uint64_t RookMask[64];
 static uint64_t KingMask[64];
+static uint64_t BetweenMask[64][64];
 
 static const uint64_t BishopMagic[64] = {
     0x404040404040ULL, 0xa060401007fcULL, 0x401020200000ULL, 0x806004000000ULL,
@@ -150,6 +151,14 @@ uint64_t KingAttacks(const int sq)
     return KingMask[sq];
 }
 
+// The squares strictly between two squares on a line, or nothing.
+uint64_t Between(const int a, const int b)
+{
+    assert(a >= 0 && a <= 63);
+    assert(b >= 0 && b <= 63);
+    return BetweenMask[a][b];
+}
+
 // Steffan Westcott's innovation.
 static uint64_t SNOOB(const uint64_t set, const uint64_t subset)
 {
@@ -333,4 +342,20 @@ void InitMagics()
         KingMask[sq] |= (from<<7) & (~FileHMask); // Down 1 Right 1
         KingMask[sq] |= (from<<9) & (~FileAMask); // Down 1 Left 1
     }
+
+    // Lines between squares
+    for (sq = 0; sq < 64; sq++) {
+        int to;
+
+        for (to = 0; to < 64; to++) {
+            uint64_t a = 1ULL << sq, z = 1ULL << to;
+
+            BetweenMask[sq][to] = 0;
+
+            if (RookAttacks(sq, 0) & z)
+                BetweenMask[sq][to] = RookAttacks(sq, z) & RookAttacks(to, a);
+            if (BishopAttacks(sq, 0) & z)
+                BetweenMask[sq][to] = BishopAttacks(sq, z) & BishopAttacks(to, a);
+        }
+    }
 }
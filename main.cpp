@@ -25,10 +25,12 @@
 #include <float.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include <fstream>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -56,25 +58,372 @@ int ReadClock()
 #endif
 }
 
-#define GAMELENGTH 40
-int starttime, timelimit, hardtimelimit;
+struct Option {
+    const char * name;
+    int * value;
+    int check; // Check box rather than spin box
+    int min, max;
+};
+
+static const struct Option options[] = {
+    { "Reverse Futility Pruning", &params.rfp,          1, 0, 1    },
+    { "RFP Depth",                &params.rfp_depth,    0, 0, 16   },
+    { "RFP Margin",               &params.rfp_margin,   0, 0, 1000 },
+    { "Futility Pruning",         &params.fut,          1, 0, 1    },
+    { "Futility Depth",           &params.fut_depth,    0, 0, 16   },
+    { "Futility Margin",          &params.fut_margin,   0, 0, 1000 },
+    { "Razoring",                 &params.razor,        1, 0, 1    },
+    { "Razor Depth",              &params.razor_depth,  0, 0, 16   },
+    { "Razor Margin",             &params.razor_margin, 0, 0, 1000 },
+    { "Late Move Pruning",        &params.lmp,          1, 0, 1    },
+    { "LMP Depth",                &params.lmp_depth,    0, 0, 16   },
+    { "LMP Count",                &params.lmp_count,    0, 0, 256  },
+    { "SEE Pruning",              &params.see,          1, 0, 1    },
+    { "SEE Depth",                &params.see_depth,    0, 0, 16   },
+    { "SEE Margin",               &params.see_margin,   0, 0, 1000 },
+    { "Delta Pruning",            &params.delta,        1, 0, 1    },
+    { "Delta Margin",             &params.delta_margin, 0, 0, 1000 },
+    { "QS SEE Pruning",           &params.qsee,         1, 0, 1    },
+    { "QS Checks",                &params.qchecks,      1, 0, 1    },
+    { "Move Overhead",            &moveoverhead,        0, 0, 5000 },
+    { "MultiPV",                  &multipv,             0, 1, MAX_MOVES },
+    { "Use NNUE",                 &usennue,             1, 0, 1    },
+};
+
+// The network weights are read from this file at startup, or when changed.
+static char evalfile[256] = "hoarfrost.nnue";
+
+static void PrintOptions()
+{
+    int kernel, first = 1;
+
+    for (const struct Option& o : options) {
+        if (o.check)
+            printf("feature option=\"%s -check %d\"\n", o.name, *o.value);
+        else
+            printf("feature option=\"%s -spin %d %d %d\"\n", o.name, *o.value, o.min, o.max);
+    }
+
+    printf("feature option=\"EvalFile -file %s\"\n", evalfile);
+
+    // Only the kernels this CPU has are offered.
+    printf("feature option=\"PST Kernel -combo");
+
+    for (kernel = 0; kernel < PST_KERNELS; kernel++) {
+        if (PSTKernelSupported(kernel)) {
+            printf("%s%s%s", first ? " " : " /// ", kernel == pstkernel ? "*" : "", PSTKernelName(kernel));
+            first = 0;
+        }
+    }
+
+    printf("\"\n");
+}
+
+static void SetOption(char * str)
+{
+    char * value = strchr(str, '=');
+    int kernel;
+
+    if (value == NULL)
+        return;
+
+    *value++ = '\0';
+
+    if (!strcmp(str, "EvalFile")) {
+        snprintf(evalfile, sizeof(evalfile), "%s", value);
+
+        if (!LoadNNUE(evalfile))
+            printf("Error (cannot load network): %s\n", evalfile);
+
+        return;
+    }
+
+    if (!strcmp(str, "PST Kernel")) {
+        for (kernel = 0; kernel < PST_KERNELS; kernel++) {
+            if (!strcmp(value, PSTKernelName(kernel)) && SetPSTKernel(kernel))
+                return;
+        }
+
+        printf("Error (unsupported PST kernel): %s\n", value);
+        return;
+    }
+
+    for (const struct Option& o : options) {
+        if (!strcmp(o.name, str)) {
+            *o.value = min(max(atoi(value), o.min), o.max);
+            return;
+        }
+    }
+
+    printf("Error (unknown option): %s\n", str);
+}
+
+// Set one of p's search parameters by its option name, with underscores in
+// place of spaces. Only the options that are search parameters qualify.
+static bool SetParam(struct SearchParams * p, const char * name, int value)
+{
+    char buf[64], * c;
+
+    for (const struct Option& o : options) {
+        char * field = (char *)o.value;
+
+        if (field < (char *)&params || field >= (char *)(&params + 1))
+            continue;
+
+        snprintf(buf, sizeof(buf), "%s", o.name);
+
+        for (c = buf; *c; c++) {
+            if (*c == ' ')
+                *c = '_';
+        }
+
+        if (!strcmp(buf, name)) {
+            *(int *)((char *)p + (field - (char *)&params)) = min(max(value, o.min), o.max);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// A fixed set of positions searched to a fixed depth, so that changes to the
+// search can be compared by node count and speed.
+static const char * benchfens[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP3PPP/R2QKB1R w KQ - 0 8",
+    "2r3k1/pp3ppp/4p3/3n4/3P4/P3B3/1P3PPP/2R3K1 b - - 0 25",
+};
+
+static void Bench(struct SearchContext * ctx, int depth)
+{
+    struct KeyStack keys;
+    struct Board b;
+    struct PV pv;
+    uint64_t total = 0, qtotal = 0;
+    int start, elapsed;
+
+    start = ReadClock();
+
+    for (const char * fen : benchfens) {
+        ParseFEN(&b, (char *)fen);
+        ClearTT(&tt);
+
+        keys.count = 0;
+
+        ClearHistory(ctx);
+        InitSearch(ctx, &b, &keys);
+        StartClockInfinite(&ctx->clock);
+
+        Think(ctx, depth, &pv, 0);
+
+        printf("%-72s %9d %9d\n", fen, ctx->nodes, ctx->qnodes);
+
+        total += ctx->nodes;
+        qtotal += ctx->qnodes;
+    }
+
+    elapsed = max(ReadClock() - start, 1);
+
+    printf("Nodes: %llu QNodes: %llu Time: %d msec NPS: %llu\n", total, qtotal, elapsed, total * 1000 / elapsed);
+}
 
-int main()
+// Make, evaluate and unmake every legal move of the bench positions, to
+// compare the speed of the evaluators including their incremental updates.
+static void EvalBenchRun(const char * name, int iterations)
+{
+    int i, j, count, elapsed, start, dirty;
+    uint64_t evals = 0;
+    int64_t total = 0;
+    struct Move moves[MAX_MOVES];
+    struct DirtyPiece d[3];
+    struct Undo u;
+    struct Board b;
+    // The root's accumulators and each move's, as the search keeps them.
+    static struct Accumulator acc[2];
+
+    start = ReadClock();
+
+    for (const char * fen : benchfens) {
+        ParseFEN(&b, (char *)fen);
+
+        if (NNUEActive())
+            RefreshNNUE(&b, &acc[0]);
+
+        count = GenerateCaptures(&b, moves, 0);
+        count = GenerateQuiets(&b, moves, count);
+
+        for (i = 0; i < iterations; i++) {
+            for (j = 0; j < count; j++) {
+                MakeMove(&b, &u, moves[j]);
+
+                if (!IsIllegal(&b)) {
+                    if (NNUEActive()) {
+                        dirty = DirtyPieces(&b, &u, moves[j], d);
+                        UpdateNNUE(&b, d, dirty, &acc[0], &acc[1]);
+                        total += EvalNNUE(&b, &acc[1]);
+                    } else {
+                        total += Eval(&b);
+                    }
+                    evals++;
+                }
+
+                UnmakeMove(&b, &u, moves[j]);
+            }
+        }
+    }
+
+    elapsed = max(ReadClock() - start, 1);
+
+    printf("%s: %llu evals in %d msec, %llu evals/sec (checksum %lld)\n", name,
+           evals, elapsed, evals * 1000 / elapsed, total);
+}
+
+static void EvalBench(int iterations)
+{
+    char name[64];
+    int saved = usennue, savedkernel = pstkernel, kernel;
+
+    usennue = 0;
+
+    // Every PST kernel this CPU has; their checksums must be the same.
+    for (kernel = 0; kernel < PST_KERNELS; kernel++) {
+        if (SetPSTKernel(kernel)) {
+            snprintf(name, sizeof(name), "Classical (%s)", PSTKernelName(kernel));
+            EvalBenchRun(name, iterations);
+        }
+    }
+
+    SetPSTKernel(savedkernel);
+
+    usennue = 1;
+
+    if (NNUEActive())
+        EvalBenchRun("NNUE", iterations);
+    else
+        printf("NNUE: no network loaded\n");
+
+    usennue = saved;
+}
+
+// Game history, so that moves can be taken back and the search can see
+// repetitions of earlier positions.
+static struct KeyStack game;
+static struct Move gamemoves[MAX_GAME];
+static struct Undo gameundo[MAX_GAME];
+
+static void NewGame(struct Board * b, const char * fen)
+{
+    ParseFEN(b, (char *)fen);
+
+    game.count = 0;
+    game.keys[game.count++] = b->hash;
+}
+
+static void PlayMove(struct Board * b, struct Move m)
+{
+    // Only the last hundred plies can be repeated.
+    if (game.count == MAX_GAME) {
+        memmove(game.keys, game.keys + MAX_GAME - 100, 100 * sizeof(uint64_t));
+        memmove(gamemoves, gamemoves + MAX_GAME - 100, 100 * sizeof(struct Move));
+        memmove(gameundo, gameundo + MAX_GAME - 100, 100 * sizeof(struct Undo));
+        game.count = 100;
+    }
+
+    gamemoves[game.count] = m;
+    MakeMove(b, &gameundo[game.count], m);
+    game.keys[game.count++] = b->hash;
+}
+
+static void TakeBack(struct Board * b)
+{
+    if (game.count <= 1)
+        return;
+
+    game.count--;
+    UnmakeMove(b, &gameundo[game.count], gamemoves[game.count]);
+}
+
+// Pondering: after moving, search the reply the PV expects in the
+// background. If the opponent plays it, that search becomes ours.
+static int ponder = 0;
+static std::thread ponderthread;
+static struct KeyStack pondergame;
+static struct Move pondermove;
+static struct PV ponderpv;
+static int ponderscore;
+
+static void PonderSearch(struct SearchContext * ctx)
+{
+    ponderscore = Think(ctx, 64, &ponderpv, 1);
+}
+
+static void StartPonder(struct SearchContext * ctx, struct Board * b, struct Move m)
+{
+    struct Board c = *b;
+    struct Undo u;
+
+    MakeMove(&c, &u, m);
+
+    pondermove = m;
+    pondergame = game;
+    pondergame.keys[pondergame.count++] = c.hash;
+
+    InitSearch(ctx, &c, &pondergame);
+    StartClockInfinite(&ctx->clock);
+
+    ponderthread = std::thread(PonderSearch, ctx);
+}
+
+static void StopPonder(struct SearchContext * ctx)
+{
+    if (!ponderthread.joinable())
+        return;
+
+    ctx->stop.store(1, std::memory_order_relaxed);
+    ponderthread.join();
+}
+
+// Commands that leave the board and search alone, so pondering goes on.
+static bool KeepsPondering(const char * str)
+{
+    static const char * commands[] = {
+        "usermove", "time", "otim", "hard", "post", "nopost", "computer", "accepted", "rejected",
+    };
+
+    for (const char * c : commands) {
+        if (!strncmp(str, c, strlen(c)))
+            return true;
+    }
+
+    return false;
+}
+
+int main(int argc, char ** argv)
 {
     InitMagics();
     InitZobrist();
+    InitEval();
+
+    // Run a perft suite and exit, failing if any count is wrong.
+    if (argc >= 3 && !strcmp(argv[1], "perftsuite"))
+        return PerftSuite(argv[2], max((argc >= 4) ? atoi(argv[3]) : (int)std::thread::hardware_concurrency(), 1)) != 0;
 
+    static struct SearchContext ctx;
     struct Board b;
-    struct Undo u;
-    struct Move m[128];
     char str[400];
-    int i, n;
     int side = FORCE;
-    int timeleft = 300000, movestogo = 0, inc = 8000;
+    int timeleft = 300000, mps = 0, movestogo = 0, inc = 8000;
+
+    NewGame(&b, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
 
-    ParseFEN(&b, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    ResizeTT(&tt, 16);
 
-    ResizeTT(16);
+    LoadNNUE(evalfile);
 
     setvbuf(stdout, NULL, _IONBF, 0);
 
@@ -82,53 +431,40 @@ int main()
 
         if (b.side == side) {
             struct PV pv;
-            int finish, depth;
             int qscore, score;
 
-            nodes = 0;
-            cuts = 0;
-            finish = 0;
-
-            starttime = ReadClock();
-
-            qscore = Quies(&b, -10000, +10000);
-
-            if (!movestogo)
-                timelimit = (timeleft / GAMELENGTH) + inc;
-            else
-                timelimit = (timeleft / movestogo) + inc;
-
-            timelimit -= 20; // safety buffer
-
-            hardtimelimit = timelimit;
-            timelimit = hardtimelimit / 2;
+            if (ponderthread.joinable()) {
+                // Ponder hit: give the search under way a real clock.
+                StartClock(&ctx.hitclock, timeleft, movestogo, inc);
+                ctx.ponderhit.store(true, std::memory_order_release);
 
-            stopsearch = 0;
+                printf("# ponder hit, allocating %d msec, hard limit of %d\n", ctx.hitclock.timelimit, ctx.hitclock.hardtimelimit);
 
-            printf("# allocating %d msec, hard limit of %d\n", timelimit, hardtimelimit);
+                ponderthread.join();
 
-            for (depth = 1; depth <= 20; depth++) {
+                pv = ponderpv;
+                score = ponderscore;
 
-                score = Search(&b, depth, -10000, +10000, 1, &pv);
+                printf("# First: %d Cuts: %d\n", ctx.first, ctx.cuts);
+                printf("# Nodes: %d QNodes: %d\n", ctx.nodes, ctx.qnodes);
+            } else {
+                InitSearch(&ctx, &b, &game);
+                StartClock(&ctx.clock, timeleft, movestogo, inc);
 
-                finish = ReadClock();
+                // Only the searches for our own moves show extra lines.
+                ctx.multipv = multipv;
 
-                printf("%d %d %d %d ", depth, score, (finish-starttime)/10, nodes);
+                qscore = Quies(&ctx, -10000, +10000, 1, 0);
 
-                for (i = 0; i < pv.count; i++) {
-                    PrintMove(&b, pv.moves[i]);
-                    printf(" ");
-                }
+                printf("# allocating %d msec, hard limit of %d\n", ctx.clock.timelimit, ctx.clock.hardtimelimit);
 
-                printf("\n");
+                score = Think(&ctx, 64, &pv, 1);
 
-                if (finish - starttime >= timelimit)
-                    break;
+                printf("# First: %d Cuts: %d\n", ctx.first, ctx.cuts);
+                printf("# Nodes: %d QNodes: %d\n", ctx.nodes, ctx.qnodes);
+                printf("# QS: %d AB: %d Diff: %d\n", qscore, score, qscore-score);
             }
 
-            printf("# First: %d Cuts: %d\n", first, cuts);
-            printf("# QS: %d AB: %d Diff: %d\n", qscore, score, qscore-score);
-
             if (pv.count) {
                 printf("move ");
                 PrintMove(&b, pv.moves[0]);
@@ -139,18 +475,146 @@ int main()
                 continue;
             }
 
-            MakeMove(&b, &u, pv.moves[0]);
+            PlayMove(&b, pv.moves[0]);
+
+            // Start a new time control once this session's moves are made.
+            if (mps && --movestogo <= 0)
+                movestogo = mps;
 
-            if (movestogo)
-                movestogo--;
+            if (ponder && pv.count >= 2)
+                StartPonder(&ctx, &b, pv.moves[1]);
         }
 
         if (fgets(str, 400, stdin) == NULL) {
             break;
         }
 
+        if (ponderthread.joinable() && !KeepsPondering(str))
+            StopPonder(&ctx);
+
+        if (!strncmp(str, "hard", 4)) {
+            ponder = 1;
+            continue;
+        }
+
+        if (!strncmp(str, "easy", 4)) {
+            ponder = 0;
+            continue;
+        }
+
         if (!strncmp(str, "protover 2", 8)) {
-            printf("feature done=0 myname=\"Hoarfrost\" setboard=1 usermove=1 restart=1 done=1\n");
+            printf("feature done=0 myname=\"Hoarfrost\" setboard=1 usermove=1 restart=1\n");
+            PrintOptions();
+            printf("feature done=1\n");
+            continue;
+        }
+
+        if (!strncmp(str, "option", 6)) {
+            str[strcspn(str, "\r\n")] = '\0';
+            SetOption(str+7);
+            continue;
+        }
+
+        if (!strncmp(str, "tune", 4)) {
+            char path[256];
+            int epochs = 1000, threads = std::thread::hardware_concurrency();
+
+            if (sscanf(str, "tune %255s %d %d", path, &epochs, &threads) < 1) {
+                printf("Error (usage): tune <file> [epochs] [threads]\n");
+                continue;
+            }
+
+            Tune(path, epochs, max(threads, 1));
+            continue;
+        }
+
+        if (!strncmp(str, "selfplay", 8)) {
+            struct SearchParams challenger = params;
+            int counts[3] = { 1000, (int)std::thread::hardware_concurrency(), 20000 };
+            double elo0 = 0.0, elo1 = 5.0;
+            char * path = strtok(str + 8, " \t\r\n");
+            char * token, * value;
+            int numbers = 0, ok = 1;
+
+            if (path == NULL) {
+                printf("Error (usage): selfplay <openings> [games] [threads] [nodes] [Option_Name=value ...] [elo0=x] [elo1=y]\n");
+                continue;
+            }
+
+            // The challenger is the current settings with the overrides given.
+            while ((token = strtok(NULL, " \t\r\n")) != NULL) {
+                if ((value = strchr(token, '=')) == NULL) {
+                    if (numbers < 3)
+                        counts[numbers++] = atoi(token);
+                    continue;
+                }
+
+                *value++ = '\0';
+
+                if (!strcmp(token, "elo0")) {
+                    elo0 = atof(value);
+                } else if (!strcmp(token, "elo1")) {
+                    elo1 = atof(value);
+                } else if (!SetParam(&challenger, token, atoi(value))) {
+                    printf("Error (unknown search parameter): %s\n", token);
+                    ok = 0;
+                }
+            }
+
+            if (ok)
+                SelfPlay(path, max(counts[0], 1), max(counts[1], 1), max(counts[2], 1), &challenger, elo0, elo1);
+
+            continue;
+        }
+
+        if (!strncmp(str, "profile", 7)) {
+            ProfileReport();
+            continue;
+        }
+
+        if (!strncmp(str, "savehash", 8)) {
+            char path[256];
+
+            if (sscanf(str, "savehash %255s", path) != 1) {
+                printf("Error (usage): savehash <file>\n");
+                continue;
+            }
+
+            if (!SaveTT(&tt, path))
+                printf("Error (cannot save hash): %s\n", path);
+
+            continue;
+        }
+
+        if (!strncmp(str, "loadhash", 8)) {
+            char path[256], mode[16] = "";
+
+            if (sscanf(str, "loadhash %255s %15s", path, mode) < 1) {
+                printf("Error (usage): loadhash <file> [shared]\n");
+                continue;
+            }
+
+            if (!LoadTT(&tt, path, !strcmp(mode, "shared")))
+                printf("Error (cannot load hash): %s\n", path);
+
+            continue;
+        }
+
+        if (!strncmp(str, "evalbench", 9)) {
+            int iterations = 10000;
+
+            sscanf(str, "evalbench %d", &iterations);
+
+            EvalBench(iterations);
+            continue;
+        }
+
+        if (!strncmp(str, "bench", 5)) {
+            int depth = 7;
+
+            sscanf(str, "bench %d", &depth);
+
+            Bench(&ctx, depth);
             continue;
         }
 
@@ -165,18 +629,20 @@ int main()
         }
 
         if (!strncmp(str, "setboard", 8)) {
-            ParseFEN(&b, str+9);
+            NewGame(&b, str+9);
             continue;
         }
 
         if (!strncmp(str, "epd", 3)) {
             printf("\nPosition: %s\n", str+4);
-            ParseFEN(&b, str+4);
+            NewGame(&b, str+4);
             continue;
         }
 
         if (!strncmp(str, "new", 3)) {
-            ParseFEN(&b, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+            NewGame(&b, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+            ClearHistory(&ctx);
+            movestogo = mps;
             continue;
         }
 
@@ -198,6 +664,19 @@ int main()
             continue;
         }
 
+        if (!strncmp(str, "perftsuite", 10)) {
+            char path[256];
+            int threads = std::thread::hardware_concurrency();
+
+            if (sscanf(str, "perftsuite %255s %d", path, &threads) < 1) {
+                printf("Error (usage): perftsuite <file> [threads]\n");
+                continue;
+            }
+
+            PerftSuite(path, max(threads, 1));
+            continue;
+        }
+
         if (!strncmp(str, "perft", 5)) {
             int depth;
             uint64_t correct, result;
@@ -216,36 +695,38 @@ int main()
         }
 
         if (!strncmp(str, "usermove", 8)) {
-            struct Move tmp, m;
-            tmp.from = str[9] - 'a';
-            tmp.from += 8*(str[10] - '1');
-            tmp.dest = str[11] - 'a';
-            tmp.dest += 8*(str[12] - '1');
-
-            struct Sort s;
-            int found = 0;
-
-            InitSort(&b, &s, tmp);
+            struct Move moves[MAX_MOVES];
+            int from, dest, prom = NO_PIECE;
+            int found = 0, count, i;
+
+            from = (str[9] - 'a') + 8*(str[10] - '1');
+            dest = (str[11] - 'a') + 8*(str[12] - '1');
+
+            switch (str[13]) {
+            case 'n': prom = KNIGHT; break;
+            case 'b': prom = BISHOP; break;
+            case 'r': prom = ROOK; break;
+            case 'q': prom = QUEEN; break;
+            }
 
-            while (NextMove(&s, &m)) {
+            count = GenerateLegal(&b, moves, 0);
 
-                printf("# ");
-                PrintMove(&b, m);
-                printf(" %d \n", m.score);
+            for (i = 0; i < count; i++) {
+                if (moves[i].from == from && moves[i].dest == dest && moves[i].prom() == prom) {
+                    // Any move but the one pondered on makes that search useless.
+                    if (moves[i] != pondermove)
+                        StopPonder(&ctx);
 
-                if ((m.from&63) == tmp.from && (m.dest&63) == tmp.dest) {
-                    MakeMove(&b, &u, m);
+                    PlayMove(&b, moves[i]);
                     found = 1;
-
-                    if (movestogo)
-                        movestogo--;
-
                     break;
                 }
             }
 
-            if (!found)
+            if (!found) {
+                StopPonder(&ctx);
                 printf("Illegal move\n");
+            }
 
             continue;
         }
@@ -262,10 +743,12 @@ int main()
         if (!strncmp(str, "level", 5)) {
             int min, sec = 0;
             float fractinc;
-            if (sscanf(str, "level %d %d %f", &movestogo, &min, &fractinc) != 3) {
-                sscanf(str, "level %d %d:%d %f", &movestogo, &min, &sec, &fractinc);
+            if (sscanf(str, "level %d %d %f", &mps, &min, &fractinc) != 3) {
+                sscanf(str, "level %d %d:%d %f", &mps, &min, &sec, &fractinc);
             }
 
+            movestogo = mps;
+
             inc = fractinc * 1000.0;
 
             continue;
@@ -289,7 +772,13 @@ int main()
         }
 
         if (!strncmp(str, "undo", 4)) {
-            UnmakeMove(&b, &u, m[i]);
+            TakeBack(&b);
+            continue;
+        }
+
+        if (!strncmp(str, "remove", 6)) {
+            TakeBack(&b);
+            TakeBack(&b);
             continue;
         }
 
@@ -298,5 +787,7 @@ int main()
         }
     }
 
+    StopPonder(&ctx);
+
     return 0;
 }
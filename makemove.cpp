@@ -26,6 +26,7 @@
 
 #include "board.h"
 #include "functions.h"
+#include "profile.h"
 
 static int castle_mask[64] = {
     13, 15, 15, 15, 12, 15, 15, 14,
@@ -38,134 +39,139 @@ static int castle_mask[64] = {
      7, 15, 15, 15,  3, 15, 15, 11
 };
 
-void MakeMove(struct Board * b, struct Undo * u, struct Move m)
+// Templated on the side to move, so colour-dependent offsets and table
+// indices are constants.
+template <int side>
+static inline void DoMove(struct Board * b, struct Undo * u, struct Move m)
 {
     uint64_t frombb, destbb, tmpbb;
     char epdest;
 
-    char from = m.from & 63;
-    char dest = m.dest & 63;
-    char type = m.type & 7;
-    char prom = m.prom & 7;
-    char color = m.color & 1;
-    char piece = m.piece & 7;
+    char from = m.from;
+    char dest = m.dest;
+    char type = m.type();
+    char prom = m.prom();
+    char piece = b->squares[from];
 
     frombb = 1ULL << from;
     destbb = 1ULL << dest;
 
+    u->hash = b->hash;
+    u->fifty = b->fifty;
+
+    // Pawn moves and captures are irreversible.
+    if (piece == PAWN || type == CAPTURE || type == CAPTURE_PROMOTION)
+        b->fifty = 0;
+    else
+        b->fifty++;
+
     u->ep = b->ep;
+    if (b->ep != INVALID && b->ep <= 63)
+        b->hash ^= zobrist_ep[COL(b->ep)];
     b->ep = INVALID;
 
     u->castle = b->castle;
     b->castle &= castle_mask[from] & castle_mask[dest];
+    b->hash ^= zobrist_castle[u->castle] ^ zobrist_castle[b->castle];
 
     switch (type) {
     case QUIET:
         break;
 
     case DOUBLE_PUSH:
-        if (b->side == WHITE) {
+        if (side == WHITE) {
             b->ep = dest - 8;
         } else {
             b->ep = dest + 8;
         }
+        b->hash ^= zobrist_ep[COL(b->ep)];
         break;
 
     case CAPTURE:
-        // This is awkward
-        u->cap = INVALID;
-        if (destbb & b->pieces[PAWN])
-            u->cap = PAWN;
-        else if (destbb & b->pieces[KNIGHT])
-            u->cap = KNIGHT;
-        else if (destbb & b->pieces[BISHOP])
-            u->cap = BISHOP;
-        else if (destbb & b->pieces[ROOK])
-            u->cap = ROOK;
-        else if (destbb & b->pieces[QUEEN])
-            u->cap = QUEEN;
-        else if (destbb & b->pieces[KING])
-            u->cap = KING;
+        u->cap = b->squares[dest];
 
         b->pieces[u->cap] ^= destbb;
-        b->colors[!b->side] ^= destbb;
+        b->colors[!side] ^= destbb;
+        b->hash ^= zobrist_piece[!side][u->cap][dest];
         break;
 
     case ENPASSANT:
-        if (b->side == WHITE) {
+        if (side == WHITE) {
             epdest = dest - 8;
         } else {
             epdest = dest + 8;
         }
 
         b->pieces[PAWN] ^= 1ULL << epdest;
-        b->colors[!b->side] ^= 1ULL << epdest;
+        b->colors[!side] ^= 1ULL << epdest;
+        b->squares[epdest] = NO_PIECE;
+        b->hash ^= zobrist_piece[!side][PAWN][epdest];
         break;
 
     case CASTLE:
         // Kingside
         if (dest > from) {
             tmpbb = (1ULL << (dest+1)) | (1ULL << (from+1));
+            b->squares[dest+1] = NO_PIECE;
+            b->squares[from+1] = ROOK;
+            b->hash ^= zobrist_piece[side][ROOK][dest+1] ^ zobrist_piece[side][ROOK][from+1];
         // Queenside
         } else {
             tmpbb = (1ULL << (dest-2)) | (1ULL << (from-1));
+            b->squares[dest-2] = NO_PIECE;
+            b->squares[from-1] = ROOK;
+            b->hash ^= zobrist_piece[side][ROOK][dest-2] ^ zobrist_piece[side][ROOK][from-1];
         }
 
         // Move the rook.
         b->pieces[ROOK] ^= tmpbb;
-        b->colors[b->side] ^= tmpbb;
+        b->colors[side] ^= tmpbb;
         break;
 
     case PROMOTION:
         // Change the piece type.
         b->pieces[PAWN] ^= destbb;
         b->pieces[prom] ^= destbb;
+        b->hash ^= zobrist_piece[side][PAWN][dest] ^ zobrist_piece[side][prom][dest];
         break;
 
     case CAPTURE_PROMOTION:
-        // This is awkward
-        u->cap = INVALID;
-        if (destbb & b->pieces[PAWN])
-            u->cap = PAWN;
-        else if (destbb & b->pieces[KNIGHT])
-            u->cap = KNIGHT;
-        else if (destbb & b->pieces[BISHOP])
-            u->cap = BISHOP;
-        else if (destbb & b->pieces[ROOK])
-            u->cap = ROOK;
-        else if (destbb & b->pieces[QUEEN])
-            u->cap = QUEEN;
-        else if (destbb & b->pieces[KING])
-            u->cap = KING;
+        u->cap = b->squares[dest];
 
         // Remove the piece.
         b->pieces[u->cap] ^= destbb;
-        b->colors[!b->side] ^= destbb;
+        b->colors[!side] ^= destbb;
+        b->hash ^= zobrist_piece[!side][u->cap][dest];
 
         // Change the piece type.
         b->pieces[PAWN] ^= destbb;
         b->pieces[prom] ^= destbb;
+        b->hash ^= zobrist_piece[side][PAWN][dest] ^ zobrist_piece[side][prom][dest];
         break;
     }
 
     // Move the piece.
     b->pieces[piece] ^= frombb | destbb;
-    b->colors[b->side] ^= frombb | destbb;
+    b->colors[side] ^= frombb | destbb;
+    b->squares[from] = NO_PIECE;
+    b->squares[dest] = (prom != NO_PIECE) ? prom : piece;
+    b->hash ^= zobrist_piece[side][piece][from] ^ zobrist_piece[side][piece][dest];
 
     b->side ^= 1;
+    b->hash ^= zobrist_side;
 }
 
-void UnmakeMove(struct Board * b, struct Undo * u, struct Move m)
+template <int side>
+static inline void UndoMove(struct Board * b, struct Undo * u, struct Move m)
 {
     uint64_t frombb, destbb, tmpbb;
     char epdest;
 
-    char from = m.from & 63;
-    char dest = m.dest & 63;
-    char type = m.type & 7;
-    char prom = m.prom & 7;
-    char color = m.color & 1;
-    char piece = m.piece & 7;
+    char from = m.from;
+    char dest = m.dest;
+    char type = m.type();
+    char prom = m.prom();
+    char piece = (prom != NO_PIECE) ? PAWN : b->squares[dest];
 
     frombb = 1ULL << from;
     destbb = 1ULL << dest;
@@ -182,12 +188,12 @@ void UnmakeMove(struct Board * b, struct Undo * u, struct Move m)
     case CAPTURE:
         // Add the captured piece.
         b->pieces[u->cap] ^= destbb;
-        b->colors[!b->side] ^= destbb;
+        b->colors[!side] ^= destbb;
         break;
 
     case ENPASSANT:
         // Get the piece location.
-        if (b->side == WHITE) {
+        if (side == WHITE) {
             epdest = dest - 8;
         } else {
             epdest = dest + 8;
@@ -195,21 +201,26 @@ void UnmakeMove(struct Board * b, struct Undo * u, struct Move m)
 
         // Add the captured piece.
         b->pieces[PAWN] ^= 1ULL << epdest;
-        b->colors[!b->side] ^= 1ULL << epdest;
+        b->colors[!side] ^= 1ULL << epdest;
+        b->squares[epdest] = PAWN;
         break;
 
     case CASTLE:
         // Kingside
         if (dest > from) {
             tmpbb = (1ULL << (dest+1)) | (1ULL << (from+1));
+            b->squares[dest+1] = ROOK;
+            b->squares[from+1] = NO_PIECE;
         // Queenside
         } else {
             tmpbb = (1ULL << (dest-2)) | (1ULL << (from-1));
+            b->squares[dest-2] = ROOK;
+            b->squares[from-1] = NO_PIECE;
         }
 
         // Move the rook.
         b->pieces[ROOK] ^= tmpbb;
-        b->colors[b->side] ^= tmpbb;
+        b->colors[side] ^= tmpbb;
         break;
 
     case PROMOTION:
@@ -221,7 +232,7 @@ void UnmakeMove(struct Board * b, struct Undo * u, struct Move m)
     case CAPTURE_PROMOTION:
         // Remove the piece.
         b->pieces[u->cap] ^= destbb;
-        b->colors[!b->side] ^= destbb;
+        b->colors[!side] ^= destbb;
 
         // Change the piece type.
         b->pieces[PAWN] ^= destbb;
@@ -233,7 +244,87 @@ void UnmakeMove(struct Board * b, struct Undo * u, struct Move m)
 
     b->ep = u->ep;
 
+    b->fifty = u->fifty;
+    b->hash = u->hash;
+
     // Move the piece.
     b->pieces[piece] ^= frombb | destbb;
-    b->colors[b->side] ^= frombb | destbb;
+    b->colors[side] ^= frombb | destbb;
+    b->squares[from] = piece;
+    b->squares[dest] = (type == CAPTURE || type == CAPTURE_PROMOTION) ? u->cap : NO_PIECE;
+}
+
+void MakeMove(struct Board * b, struct Undo * u, struct Move m)
+{
+    PROFILE_ZONE(ZONE_MAKE_MOVE);
+
+    if (b->side == WHITE)
+        DoMove<WHITE>(b, u, m);
+    else
+        DoMove<BLACK>(b, u, m);
+}
+
+void UnmakeMove(struct Board * b, struct Undo * u, struct Move m)
+{
+    // The side that made the move.
+    if (b->side == BLACK)
+        UndoMove<WHITE>(b, u, m);
+    else
+        UndoMove<BLACK>(b, u, m);
+}
+
+void MakeNullMove(struct Board * b, struct Undo * u)
+{
+    u->hash = b->hash;
+    u->fifty = b->fifty;
+    u->ep = b->ep;
+
+    if (b->ep != INVALID && b->ep <= 63)
+        b->hash ^= zobrist_ep[COL(b->ep)];
+
+    b->ep = INVALID;
+    b->fifty = 0;
+
+    b->side ^= 1;
+    b->hash ^= zobrist_side;
+}
+
+void UnmakeNullMove(struct Board * b, struct Undo * u)
+{
+    b->side ^= 1;
+
+    b->ep = u->ep;
+    b->fifty = u->fifty;
+    b->hash = u->hash;
+}
+
+// The pieces the move m changed, for the network's accumulators. The board
+// must be in its state after the move, with u the move's undo information.
+int DirtyPieces(struct Board * b, struct Undo * u, struct Move m, struct DirtyPiece * d)
+{
+    int from = m.from, dest = m.dest, type = m.type(), prom = m.prom();
+    int side = !b->side;
+    int count = 0;
+
+    if (prom != NO_PIECE) {
+        d[count++] = { (char)side, (char)PAWN, (char)from, (char)INVALID };
+        d[count++] = { (char)side, (char)prom, (char)INVALID, (char)dest };
+    } else {
+        d[count++] = { (char)side, (char)b->squares[dest], (char)from, (char)dest };
+    }
+
+    if (type == CAPTURE || type == CAPTURE_PROMOTION)
+        d[count++] = { (char)!side, (char)u->cap, (char)dest, (char)INVALID };
+
+    if (type == ENPASSANT)
+        d[count++] = { (char)!side, (char)PAWN, (char)(side == WHITE ? dest - 8 : dest + 8), (char)INVALID };
+
+    if (type == CASTLE) {
+        if (dest > from)
+            d[count++] = { (char)side, (char)ROOK, (char)(dest + 1), (char)(from + 1) };
+        else
+            d[count++] = { (char)side, (char)ROOK, (char)(dest - 2), (char)(from - 1) };
+    }
+
+    return count;
 }
@@ -27,464 +27,309 @@
 
 #include "board.h"
 #include "functions.h"
+#include "profile.h"
+
+// The generator is a template on the side to move and the kind of moves
+// wanted, so that pawn directions, promotion ranks and targets are fixed
+// at compile time. The exported functions pick the instance once.
+enum { GEN_CAPTURES, GEN_QUIETS, GEN_EVASIONS, GEN_QUIET_CHECKS };
+
+template <int side> struct Pawns {
+    static const int up = (side == WHITE) ? 8 : -8;
+    static const int upleft = (side == WHITE) ? 7 : -9;
+    static const int upright = (side == WHITE) ? 9 : -7;
+    static const uint64_t rank3 = (side == WHITE) ? Rank3Mask : Rank6Mask;
+    static const uint64_t promotion = (side == WHITE) ? Rank8Mask : Rank1Mask;
+
+    static inline uint64_t Shift(uint64_t bb, int delta)
+    {
+        return (delta > 0) ? bb << delta : bb >> -delta;
+    }
+};
 
-static inline void AddMove(struct Board * b, struct Move * m, int * movecount, int from, int dest, int type, int prompiece, int color, int piece)
+static inline void AddMove(struct Move * m, int * movecount, int from, int dest, int type, int prompiece)
 {
-    struct Move n(from, dest, type, prompiece, color, piece, 0);
-    n.score = MoveValue(b, n);
-
-    m[*movecount] = n;
+    m[*movecount] = Move(from, dest, type, prompiece);
     *movecount = *movecount + 1;
 }
 
-int GenerateQuiets(struct Board * b, struct Move * m, int movecount)
+// Pawn moves to dests, which came from delta squares behind. Those reaching
+// the last rank become four promotions each.
+static inline void AddPawnMoves(struct Move * m, int * movecount, uint64_t dests, uint64_t promotion,
+                                int delta, int type, int promtype)
 {
-    uint64_t pawns, knights, bishops, rooks, queens, kings;
-    uint64_t singles, doubles, attacks;
-    uint64_t occ, empty;
-    int from, dest;
-
-    occ = b->colors[WHITE] | b->colors[BLACK];
-    empty = ~occ;
-
-    // Pawns
-    if (b->side == WHITE) {
-        pawns = b->pawns() & b->colors[WHITE];
-
-        // Single push
-        singles = (pawns << 8) & empty;
-
-        // Separate promotions
-        singles &= ~Rank8Mask;
+    int dest;
 
-        while (singles) {
-            dest = lsb(singles);
-
-            AddMove(b, m, &movecount, dest - 8, dest, QUIET, NO_PIECE, WHITE, PAWN);
-
-            singles &= singles - 1;
-        }
-
-        // Double push
-        singles = ((pawns & Rank2Mask) << 8) & empty;
-        doubles = (singles << 8) & empty;
-
-        while (doubles) {
-            dest = lsb(doubles);
-
-            AddMove(b, m, &movecount, dest - 16, dest, DOUBLE_PUSH, NO_PIECE, WHITE, PAWN);
-
-            doubles &= doubles - 1;
-        }
-
-        // Promotions
-        singles = ((pawns & Rank7Mask) << 8) & empty;
-
-        while (singles) {
-            dest = lsb(singles);
-
-            AddMove(b, m, &movecount, dest - 8, dest, PROMOTION, QUEEN, WHITE, PAWN);
-            AddMove(b, m, &movecount, dest - 8, dest, PROMOTION, ROOK, WHITE, PAWN);
-            AddMove(b, m, &movecount, dest - 8, dest, PROMOTION, BISHOP, WHITE, PAWN);
-            AddMove(b, m, &movecount, dest - 8, dest, PROMOTION, KNIGHT, WHITE, PAWN);
-
-            singles &= singles - 1;
-        }
-    } else {
-        pawns = b->pawns() & b->colors[BLACK];
-
-        // Single push
-        singles = (pawns >> 8) & empty;
-
-        // Separate promotions
-        singles &= ~Rank1Mask;
-
-        while (singles) {
-            dest = lsb(singles);
-            AddMove(b, m, &movecount, dest + 8, dest, QUIET, NO_PIECE, BLACK, PAWN);
-            singles &= singles - 1;
-        }
-
-        // Double push
-        singles = ((pawns & Rank7Mask) >> 8) & empty;
-        doubles = (singles >> 8) & empty;
-
-        while (doubles) {
-            dest = lsb(doubles);
-            AddMove(b, m, &movecount, dest + 16, dest, DOUBLE_PUSH, NO_PIECE, BLACK, PAWN);
-            doubles &= doubles - 1;
-        }
-
-        // Promotions
-        singles = ((pawns & Rank2Mask) >> 8) & empty;
-
-        while (singles) {
-            dest = lsb(singles);
-
-            AddMove(b, m, &movecount, dest + 8, dest, PROMOTION, QUEEN, BLACK, PAWN);
-            AddMove(b, m, &movecount, dest + 8, dest, PROMOTION, ROOK, BLACK, PAWN);
-            AddMove(b, m, &movecount, dest + 8, dest, PROMOTION, BISHOP, BLACK, PAWN);
-            AddMove(b, m, &movecount, dest + 8, dest, PROMOTION, KNIGHT, BLACK, PAWN);
-
-            singles &= singles - 1;
-        }
+    for (uint64_t bb = dests & ~promotion; bb; bb &= bb - 1) {
+        dest = lsb(bb);
+        AddMove(m, movecount, dest - delta, dest, type, NO_PIECE);
     }
 
-    // Knights
-    knights = b->knights() & b->colors[b->side];
-
-    while (knights) {
-        from = lsb(knights);
-
-        attacks = KnightAttacks(from) & empty;
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, from, dest, QUIET, NO_PIECE, b->side, KNIGHT);
-
-            attacks &= attacks - 1;
-        }
-
-        knights &= knights - 1;
+    for (uint64_t bb = dests & promotion; bb; bb &= bb - 1) {
+        dest = lsb(bb);
+        AddMove(m, movecount, dest - delta, dest, promtype, QUEEN);
+        AddMove(m, movecount, dest - delta, dest, promtype, ROOK);
+        AddMove(m, movecount, dest - delta, dest, promtype, BISHOP);
+        AddMove(m, movecount, dest - delta, dest, promtype, KNIGHT);
     }
+}
 
-    // Bishops
-    bishops = b->bishops() & b->colors[b->side];
-
-    while (bishops) {
-        from = lsb(bishops);
-
-        attacks = BishopAttacks(from, occ) & empty;
-
-        while (attacks) {
-            dest = lsb(attacks);
+template <int side, int gen>
+static inline void AddPieceMoves(struct Board * b, struct Move * m, int * movecount, int from, uint64_t attacks)
+{
+    int dest;
 
-            AddMove(b, m, &movecount, from, dest, QUIET, NO_PIECE, b->side, BISHOP);
+    while (attacks) {
+        dest = lsb(attacks);
 
-            attacks &= attacks - 1;
-        }
+        if (gen == GEN_CAPTURES)
+            AddMove(m, movecount, from, dest, CAPTURE, NO_PIECE);
+        else if (gen == GEN_EVASIONS)
+            AddMove(m, movecount, from, dest, (b->colors[!side] >> dest) & 1 ? CAPTURE : QUIET, NO_PIECE);
+        else
+            AddMove(m, movecount, from, dest, QUIET, NO_PIECE);
 
-        bishops &= bishops - 1;
+        attacks &= attacks - 1;
     }
+}
 
-    // Rooks
-    rooks = b->rooks() & b->colors[b->side];
-
-    while (rooks) {
-        from = lsb(rooks);
-
-        attacks = RookAttacks(from, occ) & empty;
+// Pushes go to pushes, captures to captures.
+template <int side, int gen>
+static void GeneratePawnMoves(struct Board * b, struct Move * m, int * movecount, uint64_t pushes, uint64_t captures)
+{
+    typedef Pawns<side> P;
 
-        while (attacks) {
-            dest = lsb(attacks);
+    uint64_t pawns = b->pawns() & b->colors[side];
+    uint64_t empty = ~(b->colors[WHITE] | b->colors[BLACK]);
+    uint64_t singles, doubles, attacks;
+    int from;
 
-            AddMove(b, m, &movecount, from, dest, QUIET, NO_PIECE, b->side, ROOK);
+    if (gen != GEN_CAPTURES) {
+        singles = P::Shift(pawns, P::up) & empty;
+        doubles = P::Shift(singles & P::rank3, P::up) & empty & pushes;
+        singles &= pushes;
 
-            attacks &= attacks - 1;
-        }
+        AddPawnMoves(m, movecount, singles & ~P::promotion, 0, P::up, QUIET, PROMOTION);
+        AddPawnMoves(m, movecount, doubles, 0, 2*P::up, DOUBLE_PUSH, PROMOTION);
 
-        rooks &= rooks - 1;
+        // Promotions are searched with the quiets, but not as quiet checks.
+        if (gen != GEN_QUIET_CHECKS)
+            AddPawnMoves(m, movecount, singles & P::promotion, P::promotion, P::up, QUIET, PROMOTION);
     }
 
-    // Queens
-    queens = b->queens() & b->colors[b->side];
+    if (gen == GEN_CAPTURES || gen == GEN_EVASIONS) {
+        attacks = P::Shift(pawns & ~FileAMask, P::upleft) & captures;
+        AddPawnMoves(m, movecount, attacks, P::promotion, P::upleft, CAPTURE, CAPTURE_PROMOTION);
 
-    while (queens) {
-        from = lsb(queens);
+        attacks = P::Shift(pawns & ~FileHMask, P::upright) & captures;
+        AddPawnMoves(m, movecount, attacks, P::promotion, P::upright, CAPTURE, CAPTURE_PROMOTION);
 
-        attacks = QueenAttacks(from, occ) & empty;
+        // En passant, which only evades a check from the pawn just pushed
+        if (b->ep != INVALID && b->ep <= 63 && (captures & (1ULL << (b->ep - P::up)))) {
+            attacks = PawnAttacks(!side, b->ep) & pawns;
 
-        while (attacks) {
-            dest = lsb(attacks);
+            while (attacks) {
+                from = lsb(attacks);
 
-            AddMove(b, m, &movecount, from, dest, QUIET, NO_PIECE, b->side, QUEEN);
+                AddMove(m, movecount, from, b->ep, ENPASSANT, NO_PIECE);
 
-            attacks &= attacks - 1;
+                attacks &= attacks - 1;
+            }
         }
-
-        queens &= queens - 1;
     }
+}
 
-    // Kings
-    kings = b->kings() & b->colors[b->side];
-
-    while (kings) {
-        from = lsb(kings);
-
-        attacks = KingAttacks(from) & empty;
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, from, dest, QUIET, NO_PIECE, b->side, KING);
-
-            attacks &= attacks - 1;
+template <int side>
+static void GenerateCastling(struct Board * b, struct Move * m, int * movecount)
+{
+    uint64_t empty = ~(b->colors[WHITE] | b->colors[BLACK]);
+    int from = (side == WHITE) ? 4 : 60;
+
+    // Can't castle out of check
+    if (!(b->castle & (side == WHITE ? 3 : 12)) || IsInCheck(b))
+        return;
+
+    if (b->castle & (1 << (2*side))) {
+        /* Can't castle through check */
+        if (!IsAttacked(b,!side,from+1) && !IsAttacked(b,!side,from+2) &&
+                ((1ULL << (from+1)) & empty) && ((1ULL << (from+2)) & empty)) {
+            AddMove(m, movecount, from, from + 2, CASTLE, NO_PIECE);
         }
-
-        kings &= kings - 1;
     }
 
-    // Castling - can't castle out of check
-    if (!IsInCheck(b)) {
-
-        from = lsb(b->pieces[KING] & b->colors[b->side]);
-
-        if (b->castle & (1 << (2*(b->side == BLACK)))) {
-            /* Can't castle through check */
-            if (!IsAttacked(b,!b->side,from+1) && !IsAttacked(b,!b->side,from+2) &&
-                    ((1ULL << (from+1)) & empty) && ((1ULL << (from+2)) & empty)) {
-                AddMove(b, m, &movecount, from, from + 2, CASTLE, NO_PIECE, b->side, KING);
-            }
-        }
-
-        if (b->castle & (2 << (2*(b->side == BLACK)))) {
-            if (!IsAttacked(b,!b->side,from-1) && !IsAttacked(b,!b->side,from-2) &&
-                    ((1ULL << (from-1)) & empty) && ((1ULL << (from-2)) & empty) && ((1ULL << (from-3)) & empty)) {
-                AddMove(b, m, &movecount, from, from - 2, CASTLE, NO_PIECE, b->side, KING);
-            }
+    if (b->castle & (2 << (2*side))) {
+        if (!IsAttacked(b,!side,from-1) && !IsAttacked(b,!side,from-2) &&
+                ((1ULL << (from-1)) & empty) && ((1ULL << (from-2)) & empty) && ((1ULL << (from-3)) & empty)) {
+            AddMove(m, movecount, from, from - 2, CASTLE, NO_PIECE);
         }
     }
-
-    return movecount;
 }
 
-int GenerateCaptures(struct Board * b, struct Move * m, int movecount)
+// Quiet checks only go where the piece would attack the enemy king, unless
+// moving it uncovers a check anyway.
+template <int gen>
+static inline uint64_t Targets(struct CheckInfo * ci, int piece, int from, uint64_t target)
 {
-    uint64_t pawns, knights, bishops, rooks, queens, kings;
-    uint64_t attacks;
-    uint64_t occ, empty;
-    int from, dest;
-
-    occ = b->colors[WHITE] | b->colors[BLACK];
-    empty = ~occ;
-
-    // Pawns
-    if (b->side == WHITE) {
-        pawns = b->pawns() & b->colors[WHITE];
-
-        // Left captures
-        attacks = ((pawns & ~FileAMask) << 7) & b->colors[BLACK] & ~Rank8Mask;
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, dest - 7, dest, CAPTURE, NO_PIECE, WHITE, PAWN);
-
-            attacks &= attacks - 1;
-        }
-
-        // Left capture-promotions
-        attacks = ((pawns & ~FileAMask) << 7) & b->colors[BLACK] & Rank8Mask;
+    if (gen != GEN_QUIET_CHECKS || (ci->discovered & (1ULL << from)))
+        return target;
 
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, dest - 7, dest, CAPTURE_PROMOTION, QUEEN, WHITE, PAWN);
-            AddMove(b, m, &movecount, dest - 7, dest, CAPTURE_PROMOTION, ROOK, WHITE, PAWN);
-            AddMove(b, m, &movecount, dest - 7, dest, CAPTURE_PROMOTION, BISHOP, WHITE, PAWN);
-            AddMove(b, m, &movecount, dest - 7, dest, CAPTURE_PROMOTION, KNIGHT, WHITE, PAWN);
-
-            attacks &= attacks - 1;
-        }
-
-        // Right captures
-        attacks = ((pawns & ~FileHMask) << 9) & b->colors[BLACK] & ~Rank8Mask;
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, dest - 9, dest, CAPTURE, NO_PIECE, WHITE, PAWN);
-
-            attacks &= attacks - 1;
-        }
-
-        // Right capture-promotions
-        attacks = ((pawns & ~FileHMask) << 9) & b->colors[BLACK] & Rank8Mask;
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, dest - 9, dest, CAPTURE_PROMOTION, QUEEN, WHITE, PAWN);
-            AddMove(b, m, &movecount, dest - 9, dest, CAPTURE_PROMOTION, ROOK, WHITE, PAWN);
-            AddMove(b, m, &movecount, dest - 9, dest, CAPTURE_PROMOTION, BISHOP, WHITE, PAWN);
-            AddMove(b, m, &movecount, dest - 9, dest, CAPTURE_PROMOTION, KNIGHT, WHITE, PAWN);
+    return target & ci->squares[piece];
+}
 
-            attacks &= attacks - 1;
-        }
+template <int side, int gen>
+static int Generate(struct Board * b, struct Move * m, int movecount, struct CheckInfo * ci)
+{
+    uint64_t occ = b->colors[WHITE] | b->colors[BLACK];
+    uint64_t pieces, target, checkers = 0;
+    int from, king = lsb(b->kings() & b->colors[side]);
 
-        // En passant
-        if (b->ep != INVALID && b->ep <= 63) {
-            attacks = PawnAttacks(BLACK, b->ep) & b->pieces[PAWN] & b->colors[WHITE];
+    if (gen == GEN_CAPTURES) {
+        target = b->colors[!side];
+    } else if (gen == GEN_EVASIONS) {
+        // King moves, then with a single checker capturing it or blocking
+        // its ray. Pins are still left to IsIllegal().
+        AddPieceMoves<side, gen>(b, m, &movecount, king, KingAttacks(king) & ~b->colors[side]);
 
-            while (attacks) {
-                from = lsb(attacks);
+        checkers = Checkers(b);
 
-                AddMove(b, m, &movecount, from, b->ep, ENPASSANT, NO_PIECE, WHITE, PAWN);
+        // Only the king can escape a double check.
+        if (checkers & (checkers - 1))
+            return movecount;
 
-                attacks &= attacks - 1;
-            }
-        }
+        target = checkers | Between(king, lsb(checkers));
     } else {
-        pawns = b->pawns() & b->colors[BLACK];
-
-        // Left captures
-        attacks = ((pawns & ~FileAMask) >> 9) & b->colors[WHITE] & ~Rank1Mask;
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, dest + 9, dest, CAPTURE, NO_PIECE, BLACK, PAWN);
-
-            attacks &= attacks - 1;
-        }
-
-        // Left capture-promotions
-        attacks = ((pawns & ~FileAMask) >> 9) & b->colors[WHITE] & Rank1Mask;
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, dest + 9, dest, CAPTURE_PROMOTION, QUEEN, BLACK, PAWN);
-            AddMove(b, m, &movecount, dest + 9, dest, CAPTURE_PROMOTION, ROOK, BLACK, PAWN);
-            AddMove(b, m, &movecount, dest + 9, dest, CAPTURE_PROMOTION, BISHOP, BLACK, PAWN);
-            AddMove(b, m, &movecount, dest + 9, dest, CAPTURE_PROMOTION, KNIGHT, BLACK, PAWN);
-
-            attacks &= attacks - 1;
-        }
-
-        // Right captures
-        attacks = ((pawns & ~FileHMask) >> 7) & b->colors[WHITE] & ~Rank1Mask;
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, dest + 7, dest, CAPTURE, NO_PIECE, BLACK, PAWN);
-
-            attacks &= attacks - 1;
-        }
-
-        // Right capture-promotions
-        attacks = ((pawns & ~FileHMask) >> 7) & b->colors[WHITE] & Rank1Mask;
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, dest + 7, dest, CAPTURE_PROMOTION, QUEEN, BLACK, PAWN);
-            AddMove(b, m, &movecount, dest + 7, dest, CAPTURE_PROMOTION, ROOK, BLACK, PAWN);
-            AddMove(b, m, &movecount, dest + 7, dest, CAPTURE_PROMOTION, BISHOP, BLACK, PAWN);
-            AddMove(b, m, &movecount, dest + 7, dest, CAPTURE_PROMOTION, KNIGHT, BLACK, PAWN);
-
-            attacks &= attacks - 1;
-        }
-
-        // En passant
-        if (b->ep != INVALID && b->ep <= 63) {
-            attacks = PawnAttacks(WHITE, b->ep) & b->pieces[PAWN] & b->colors[BLACK];
-
-            while (attacks) {
-                from = lsb(attacks);
-
-                AddMove(b, m, &movecount, from, b->ep, ENPASSANT, NO_PIECE, BLACK, PAWN);
-
-                attacks &= attacks - 1;
-            }
-        }
+        target = ~occ;
     }
 
-    // Knights
-    knights = b->knights() & b->colors[b->side];
-
-    while (knights) {
-        from = lsb(knights);
-
-        attacks = KnightAttacks(from) & b->colors[!b->side];
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, from, dest, CAPTURE, NO_PIECE, b->side, KNIGHT);
-
-            attacks &= attacks - 1;
-        }
+    // Pawns
+    if (gen == GEN_EVASIONS)
+        GeneratePawnMoves<side, gen>(b, m, &movecount, target & ~occ, checkers);
+    else
+        GeneratePawnMoves<side, gen>(b, m, &movecount, target, target);
 
-        knights &= knights - 1;
+    // Knights
+    for (pieces = b->knights() & b->colors[side]; pieces; pieces &= pieces - 1) {
+        from = lsb(pieces);
+        AddPieceMoves<side, gen>(b, m, &movecount, from, KnightAttacks(from) & Targets<gen>(ci, KNIGHT, from, target));
     }
 
     // Bishops
-    bishops = b->bishops() & b->colors[b->side];
-
-    while (bishops) {
-        from = lsb(bishops);
-
-        attacks = BishopAttacks(from, occ) & b->colors[!b->side];
-
-        while (attacks) {
-            dest = lsb(attacks);
-
-            AddMove(b, m, &movecount, from, dest, CAPTURE, NO_PIECE, b->side, BISHOP);
-
-            attacks &= attacks - 1;
-        }
-
-        bishops &= bishops - 1;
+    for (pieces = b->bishops() & b->colors[side]; pieces; pieces &= pieces - 1) {
+        from = lsb(pieces);
+        AddPieceMoves<side, gen>(b, m, &movecount, from, BishopAttacks(from, occ) & Targets<gen>(ci, BISHOP, from, target));
     }
 
     // Rooks
-    rooks = b->rooks() & b->colors[b->side];
+    for (pieces = b->rooks() & b->colors[side]; pieces; pieces &= pieces - 1) {
+        from = lsb(pieces);
+        AddPieceMoves<side, gen>(b, m, &movecount, from, RookAttacks(from, occ) & Targets<gen>(ci, ROOK, from, target));
+    }
 
-    while (rooks) {
-        from = lsb(rooks);
+    // Queens
+    for (pieces = b->queens() & b->colors[side]; pieces; pieces &= pieces - 1) {
+        from = lsb(pieces);
+        AddPieceMoves<side, gen>(b, m, &movecount, from, QueenAttacks(from, occ) & Targets<gen>(ci, QUEEN, from, target));
+    }
 
-        attacks = RookAttacks(from, occ) & b->colors[!b->side];
+    if (gen == GEN_EVASIONS)
+        return movecount;
 
-        while (attacks) {
-            dest = lsb(attacks);
+    // Kings, which only check by uncovering a slider
+    if (gen != GEN_QUIET_CHECKS || (ci->discovered & (1ULL << king)))
+        AddPieceMoves<side, gen>(b, m, &movecount, king, KingAttacks(king) & target);
 
-            AddMove(b, m, &movecount, from, dest, CAPTURE, NO_PIECE, b->side, ROOK);
+    // Castling
+    if (gen != GEN_CAPTURES)
+        GenerateCastling<side>(b, m, &movecount);
 
-            attacks &= attacks - 1;
-        }
+    return movecount;
+}
 
-        rooks &= rooks - 1;
-    }
+int GenerateQuiets(struct Board * b, struct Move * m, int movecount)
+{
+    PROFILE_ZONE(ZONE_GENERATE_QUIETS);
 
-    // Queens
-    queens = b->queens() & b->colors[b->side];
+    if (b->side == WHITE)
+        return Generate<WHITE, GEN_QUIETS>(b, m, movecount, NULL);
+    else
+        return Generate<BLACK, GEN_QUIETS>(b, m, movecount, NULL);
+}
 
-    while (queens) {
-        from = lsb(queens);
+int GenerateCaptures(struct Board * b, struct Move * m, int movecount)
+{
+    PROFILE_ZONE(ZONE_GENERATE_CAPTURES);
 
-        attacks = QueenAttacks(from, occ) & b->colors[!b->side];
+    if (b->side == WHITE)
+        return Generate<WHITE, GEN_CAPTURES>(b, m, movecount, NULL);
+    else
+        return Generate<BLACK, GEN_CAPTURES>(b, m, movecount, NULL);
+}
 
-        while (attacks) {
-            dest = lsb(attacks);
+int GenerateEvasions(struct Board * b, struct Move * m, int movecount)
+{
+    if (b->side == WHITE)
+        return Generate<WHITE, GEN_EVASIONS>(b, m, movecount, NULL);
+    else
+        return Generate<BLACK, GEN_EVASIONS>(b, m, movecount, NULL);
+}
 
-            AddMove(b, m, &movecount, from, dest, CAPTURE, NO_PIECE, b->side, QUEEN);
+// Quiet moves that give check, for the first ply of quiescence search.
+int GenerateQuietChecks(struct Board * b, struct CheckInfo * ci, struct Move * m, int movecount)
+{
+    int i, count;
 
-            attacks &= attacks - 1;
-        }
+    if (b->side == WHITE)
+        count = Generate<WHITE, GEN_QUIET_CHECKS>(b, m, movecount, ci);
+    else
+        count = Generate<BLACK, GEN_QUIET_CHECKS>(b, m, movecount, ci);
 
-        queens &= queens - 1;
+    for (i = movecount; i < count; i++) {
+        if (GivesCheck(b, ci, m[i]))
+            m[movecount++] = m[i];
     }
 
-    // Kings
-    kings = b->kings() & b->colors[b->side];
-
-    while (kings) {
-        from = lsb(kings);
-
-        attacks = KingAttacks(from) & b->colors[!b->side];
+    return movecount;
+}
 
-        while (attacks) {
-            dest = lsb(attacks);
+// Only the moves that don't leave the king in check.
+int GenerateLegal(struct Board * b, struct Move * m, int movecount)
+{
+    struct Undo u;
+    uint64_t pinned, pinners, occ;
+    int i, count, king, from, dest, legal;
 
-            AddMove(b, m, &movecount, from, dest, CAPTURE, NO_PIECE, b->side, KING);
+    if (IsInCheck(b)) {
+        count = GenerateEvasions(b, m, movecount);
+    } else {
+        count = GenerateCaptures(b, m, movecount);
+        count = GenerateQuiets(b, m, count);
+    }
 
-            attacks &= attacks - 1;
+    king = lsb(b->kings() & b->colors[b->side]);
+    pinned = SliderBlockers(b, king, b->colors[!b->side], &pinners) & b->colors[b->side];
+    occ = (b->colors[WHITE] | b->colors[BLACK]) ^ (1ULL << king);
+
+    for (i = movecount; i < count; i++) {
+        from = m[i].from;
+        dest = m[i].dest;
+
+        if (m[i].type() == ENPASSANT) {
+            // Two pawns leave the rank at once, so just try it.
+            MakeMove(b, &u, m[i]);
+            legal = !IsIllegal(b);
+            UnmakeMove(b, &u, m[i]);
+        } else if (from == king) {
+            // Castling was checked as it was generated.
+            legal = m[i].type() == CASTLE || !IsAttackedBy(b, !b->side, dest, occ);
+        } else {
+            // Pinned pieces may only move along the pin.
+            legal = !(pinned & (1ULL << from)) ||
+                    (Between(king, dest) & (1ULL << from)) ||
+                    (Between(king, from) & (1ULL << dest));
         }
 
-        kings &= kings - 1;
+        if (legal)
+            m[movecount++] = m[i];
     }
 
     return movecount;
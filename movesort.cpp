@@ -23,69 +23,119 @@
  */
 
 #include <algorithm>
-#include <array>
+#include <utility>
 
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "board.h"
 #include "functions.h"
 
-static inline int CompareMoves(const void * p1, const void * p2)
+// Point the sort at this ply's slice of the move stack. Once the moves are
+// generated, the next ply's slice starts right after them.
+static inline void InitSlice(struct Sort * s, struct SearchContext * ctx, int ply)
 {
-    if (((struct Move*)p1)->score >  ((struct Move *)p2)->score) return -1;
-    if (((struct Move*)p1)->score == ((struct Move *)p2)->score) return 0;
-    if (((struct Move*)p1)->score <  ((struct Move *)p2)->score) return +1;
+    s->m = ctx->moves + ctx->stack[ply].first;
+    s->score = ctx->scores + ctx->stack[ply].first;
 }
 
-void InitSort(struct Board * b, struct Sort * s, struct Move ttm)
+static inline void EndSlice(struct Sort * s, struct SearchContext * ctx, int ply)
 {
-    s->movecount = GenerateCaptures(b, s->m.data(), 0);
-    s->movecount = GenerateQuiets(b, s->m.data(), s->movecount);
-
-    if (ttm.from != ttm.dest) {
-        for (s->i = 0; s->i < s->movecount; s->i++) {
-            if (s->m[s->i].from == ttm.from &&
-                s->m[s->i].dest == ttm.dest &&
-                s->m[s->i].type == ttm.type) {
-                s->m[s->i].score = 4000;
+    ctx->stack[ply + 1].first = ctx->stack[ply].first + s->movecount;
+}
+
+void InitSort(struct Board * b, struct Sort * s, struct Move ttm, struct SearchContext * ctx, int ply)
+{
+    int i;
+
+    InitSlice(s, ctx, ply);
+
+    if (IsInCheck(b)) {
+        s->movecount = GenerateEvasions(b, s->m, 0);
+    } else {
+        s->movecount = GenerateCaptures(b, s->m, 0);
+        s->movecount = GenerateQuiets(b, s->m, s->movecount);
+    }
+
+    EndSlice(s, ctx, ply);
+
+    for (i = 0; i < s->movecount; i++) {
+        s->score[i] = MoveValue(b, s->m[i]);
+
+        // Quiets that caused cutoffs elsewhere in the tree go first.
+        if (b->squares[s->m[i].dest] == NO_PIECE && s->m[i].type() != ENPASSANT)
+            s->score[i] += ctx->history[b->side][s->m[i].from][s->m[i].dest] >> 3;
+    }
+
+    if (ttm != Move()) {
+        for (i = 0; i < s->movecount; i++) {
+            if (s->m[i] == ttm) {
+                s->score[i] = INT16_MAX;
                 break;
             }
         }
     }
 
-    std::stable_sort(s->m.begin(), s->m.begin() + s->movecount);
-
     s->i = 0;
 }
 
-void InitSortQuies(struct Board * b, struct Sort * s)
+void InitSortQuies(struct Board * b, struct Sort * s, struct Move ttm, struct CheckInfo * ci, struct SearchContext * ctx, int ply)
 {
-    s->movecount = GenerateCaptures(b, s->m.data(), 0);
+    int i;
+
+    InitSlice(s, ctx, ply);
+
+    // In check every evasion has to be tried, not just the captures.
+    if (IsInCheck(b)) {
+        s->movecount = GenerateEvasions(b, s->m, 0);
+    } else {
+        s->movecount = GenerateCaptures(b, s->m, 0);
 
-    std::stable_sort(s->m.begin(), s->m.begin() + s->movecount);
+        if (ci)
+            s->movecount = GenerateQuietChecks(b, ci, s->m, s->movecount);
+    }
+
+    EndSlice(s, ctx, ply);
+
+    for (i = 0; i < s->movecount; i++) {
+        s->score[i] = (s->m[i] == ttm) ? INT16_MAX : MoveValue(b, s->m[i]);
+    }
 
     s->i = 0;
 }
 
+// Pick the best remaining move, so that lists cut off early are never sorted.
 int NextMove(struct Sort * s, struct Move * m)
 {
-    if (s->i < s->movecount) {
-        *m = s->m[s->i];
-        s->i++;
-        return 1;
+    int best, i;
+
+    if (s->i >= s->movecount)
+        return 0;
+
+    best = s->i;
+
+    for (i = s->i + 1; i < s->movecount; i++) {
+        if (s->score[i] > s->score[best])
+            best = i;
     }
-    return 0;
-};
+
+    std::swap(s->m[s->i], s->m[best]);
+    std::swap(s->score[s->i], s->score[best]);
+
+    *m = s->m[s->i];
+    s->i++;
+
+    return 1;
+}
 
 int MoveValue(struct Board * b, struct Move m)
 {
     int value = 0, cap;
 
-    char from = m.from & 63;
-    char dest = m.dest & 63;
-    char piece = m.piece & 7;
-
-    uint64_t destbb = 1ULL << dest;
+    char from = m.from;
+    char dest = m.dest;
+    char piece = b->squares[from];
 
     // PST difference as base move score.
     if (b->side == WHITE) {
@@ -95,21 +145,39 @@ int MoveValue(struct Board * b, struct Move m)
     }
 
     // SEE for winning captures and losing quiets.
-    cap = NO_PIECE;
-    if (destbb & b->pieces[PAWN])
-        cap = PAWN;
-    else if (destbb & b->pieces[KNIGHT])
-        cap = KNIGHT;
-    else if (destbb & b->pieces[BISHOP])
-        cap = BISHOP;
-    else if (destbb & b->pieces[ROOK])
-        cap = ROOK;
-    else if (destbb & b->pieces[QUEEN])
-        cap = QUEEN;
-    else if (destbb & b->pieces[KING])
-        cap = KING;
+    cap = b->squares[dest];
 
     value += piecevals[cap][0] - piece;
 
+    // Captures that lose material go after the quiet moves.
+    if (cap != NO_PIECE && !SeeGE(b, m, 0))
+        value -= 2000;
+
     return value;
 }
+
+void ClearHistory(struct SearchContext * ctx)
+{
+    memset(ctx->history, 0, sizeof(ctx->history));
+}
+
+void ReduceHistory(struct SearchContext * ctx)
+{
+    int side, from, dest;
+
+    for (side = WHITE; side <= BLACK; side++)
+        for (from = 0; from < 64; from++)
+            for (dest = 0; dest < 64; dest++)
+                ctx->history[side][from][dest] >>= 1;
+}
+
+void UpdateHistory(struct SearchContext * ctx, int side, struct Move m, int depth)
+{
+    int& h = ctx->history[side][m.from][m.dest];
+
+    h += depth * depth;
+
+    // Keep the bonus within what fits in a move score.
+    if (h > 1024)
+        ReduceHistory(ctx);
+}
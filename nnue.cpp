@@ -0,0 +1,321 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Dan Ravensloft <dan.ravensloft@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+#include "board.h"
+#include "functions.h"
+#include "profile.h"
+
+// HalfKP: each side sees every piece but the kings relative to its own king.
+// The network file is these arrays in order, little-endian, after the magic.
+#define NNUE_MAGIC   "HFNNUE01"
+#define NNUE_PIECES  10
+#define NNUE_INPUTS  (64 * NNUE_PIECES * 64)
+#define NNUE_SHIFT   6  // Fixed point shift after each hidden layer
+#define NNUE_SCALE   16 // Output units per centipawn
+#define NNUE_MAXEVAL 9000
+
+static struct {
+    alignas(64) int16_t ftbias[NNUE_HIDDEN];
+    alignas(64) int16_t ftweights[NNUE_INPUTS][NNUE_HIDDEN];
+    alignas(64) int32_t l1bias[NNUE_L2];
+    alignas(64) int8_t  l1weights[NNUE_L2][2 * NNUE_HIDDEN];
+    alignas(64) int32_t l2bias[NNUE_L3];
+    alignas(64) int8_t  l2weights[NNUE_L3][NNUE_L2];
+    alignas(64) int32_t outbias;
+    alignas(64) int8_t  outweights[NNUE_L3];
+} net;
+
+static bool loaded = false;
+
+int usennue = 0;
+
+static bool ReadArray(FILE * f, void * data, size_t size)
+{
+    return fread(data, 1, size, f) == size;
+}
+
+bool LoadNNUE(const char * path)
+{
+    FILE * f = fopen(path, "rb");
+    char magic[8];
+    bool ok;
+
+    if (f == NULL)
+        return false;
+
+    ok = ReadArray(f, magic, sizeof(magic)) && !memcmp(magic, NNUE_MAGIC, sizeof(magic)) &&
+         ReadArray(f, net.ftbias, sizeof(net.ftbias)) &&
+         ReadArray(f, net.ftweights, sizeof(net.ftweights)) &&
+         ReadArray(f, net.l1bias, sizeof(net.l1bias)) &&
+         ReadArray(f, net.l1weights, sizeof(net.l1weights)) &&
+         ReadArray(f, net.l2bias, sizeof(net.l2bias)) &&
+         ReadArray(f, net.l2weights, sizeof(net.l2weights)) &&
+         ReadArray(f, &net.outbias, sizeof(net.outbias)) &&
+         ReadArray(f, net.outweights, sizeof(net.outweights)) &&
+         fgetc(f) == EOF;
+
+    fclose(f);
+
+    loaded = ok;
+
+    return ok;
+}
+
+bool NNUEActive()
+{
+    return usennue && loaded;
+}
+
+static inline int FeatureIndex(int perspective, int king, int color, int piece, int sq)
+{
+    // Black sees the board flipped, so both sides play up the board.
+    if (perspective == BLACK) {
+        king ^= 56;
+        sq ^= 56;
+    }
+
+    return (king * NNUE_PIECES + 2 * piece + (color != perspective)) * 64 + sq;
+}
+
+// Accumulators live in the search contexts, which are not over-aligned,
+// so they are loaded and stored unaligned. The weights are aligned.
+static inline void AddFeature(int16_t * acc, int index)
+{
+    const int16_t * w = net.ftweights[index];
+    int i;
+
+#if defined(__AVX2__)
+    for (i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+        a = _mm256_add_epi16(a, _mm256_load_si256((const __m256i *)(w + i)));
+        _mm256_storeu_si256((__m256i *)(acc + i), a);
+    }
+#elif defined(__SSE4_1__)
+    for (i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+        a = _mm_add_epi16(a, _mm_load_si128((const __m128i *)(w + i)));
+        _mm_storeu_si128((__m128i *)(acc + i), a);
+    }
+#else
+    for (i = 0; i < NNUE_HIDDEN; i++)
+        acc[i] += w[i];
+#endif
+}
+
+static inline void SubFeature(int16_t * acc, int index)
+{
+    const int16_t * w = net.ftweights[index];
+    int i;
+
+#if defined(__AVX2__)
+    for (i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+        a = _mm256_sub_epi16(a, _mm256_load_si256((const __m256i *)(w + i)));
+        _mm256_storeu_si256((__m256i *)(acc + i), a);
+    }
+#elif defined(__SSE4_1__)
+    for (i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+        a = _mm_sub_epi16(a, _mm_load_si128((const __m128i *)(w + i)));
+        _mm_storeu_si128((__m128i *)(acc + i), a);
+    }
+#else
+    for (i = 0; i < NNUE_HIDDEN; i++)
+        acc[i] -= w[i];
+#endif
+}
+
+// Rebuild one side's accumulator from scratch.
+static void RefreshSide(struct Board * b, struct Accumulator * a, int perspective)
+{
+    int16_t * acc = a->values[perspective];
+    int king = lsb(b->kings() & b->colors[perspective]);
+    int color, piece, sq;
+    uint64_t bb;
+
+    memcpy(acc, net.ftbias, sizeof(net.ftbias));
+
+    for (color = WHITE; color <= BLACK; color++) {
+        for (piece = PAWN; piece <= QUEEN; piece++) {
+            bb = b->pieces[piece] & b->colors[color];
+
+            while (bb) {
+                sq = lsb(bb);
+                AddFeature(acc, FeatureIndex(perspective, king, color, piece, sq));
+                bb &= bb - 1;
+            }
+        }
+    }
+}
+
+void RefreshNNUE(struct Board * b, struct Accumulator * acc)
+{
+    RefreshSide(b, acc, WHITE);
+    RefreshSide(b, acc, BLACK);
+}
+
+// Derive a child's accumulators from its parent's and the pieces the move
+// changed. The board must already be in its new state. A side whose king
+// moved has every feature change, so it gets rebuilt instead.
+void UpdateNNUE(struct Board * b, struct DirtyPiece * d, int count, struct Accumulator * parent, struct Accumulator * acc)
+{
+    int perspective, king, i;
+
+    for (perspective = WHITE; perspective <= BLACK; perspective++) {
+        int16_t * values = acc->values[perspective];
+
+        for (i = 0; i < count; i++) {
+            if (d[i].piece == KING && d[i].color == perspective)
+                break;
+        }
+
+        if (i < count) {
+            RefreshSide(b, acc, perspective);
+            continue;
+        }
+
+        memcpy(values, parent->values[perspective], sizeof(acc->values[perspective]));
+
+        king = lsb(b->kings() & b->colors[perspective]);
+
+        for (i = 0; i < count; i++) {
+            if (d[i].piece == KING)
+                continue;
+
+            if (d[i].from != INVALID)
+                SubFeature(values, FeatureIndex(perspective, king, d[i].color, d[i].piece, d[i].from));
+            if (d[i].dest != INVALID)
+                AddFeature(values, FeatureIndex(perspective, king, d[i].color, d[i].piece, d[i].dest));
+        }
+    }
+}
+
+// Clamp the accumulator to [0, 127] as the first layer's input.
+static inline void ClippedReLU(const int16_t * acc, uint8_t * out)
+{
+    int i;
+
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (i = 0; i < NNUE_HIDDEN; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(acc + i + 16));
+        // Packing works within 128-bit lanes, so put the lanes back in order.
+        __m256i p = _mm256_max_epi8(_mm256_packs_epi16(a, b), zero);
+        _mm256_store_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(p, 0xD8));
+    }
+#elif defined(__SSE4_1__)
+    const __m128i zero = _mm_setzero_si128();
+
+    for (i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(acc + i + 8));
+        _mm_store_si128((__m128i *)(out + i), _mm_max_epi8(_mm_packs_epi16(a, b), zero));
+    }
+#else
+    for (i = 0; i < NNUE_HIDDEN; i++)
+        out[i] = max(0, min(127, (int)acc[i]));
+#endif
+}
+
+// Dot product of unsigned 7-bit inputs with signed 8-bit weights. The
+// inputs never exceed 127, so the 16-bit pair sums can't saturate and the
+// vector paths give the same result as the scalar one.
+static inline int32_t Dot(const uint8_t * in, const int8_t * w, int n)
+{
+    int32_t sum = 0;
+    int i;
+
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+
+    for (i = 0; i < n; i += 32) {
+        __m256i x = _mm256_load_si256((const __m256i *)(in + i));
+        __m256i y = _mm256_load_si256((const __m256i *)(w + i));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(x, y), ones));
+    }
+
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    sum = _mm_cvtsi128_si32(s);
+#elif defined(__SSE4_1__)
+    __m128i acc = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+
+    for (i = 0; i < n; i += 16) {
+        __m128i x = _mm_load_si128((const __m128i *)(in + i));
+        __m128i y = _mm_load_si128((const __m128i *)(w + i));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_maddubs_epi16(x, y), ones));
+    }
+
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+    sum = _mm_cvtsi128_si32(acc);
+#else
+    for (i = 0; i < n; i++)
+        sum += in[i] * w[i];
+#endif
+
+    return sum;
+}
+
+static inline void Affine(const uint8_t * in, int n, const int8_t * w, const int32_t * bias, uint8_t * out, int m)
+{
+    int i;
+
+    for (i = 0; i < m; i++)
+        out[i] = max(0, min(127, (bias[i] + Dot(in, w + i*n, n)) >> NNUE_SHIFT));
+}
+
+// The network's score in centipawns, from the side to move's point of view.
+// The output layer can reach tens of thousands of centipawns, so it is kept
+// well clear of the mate scores and of the table's 16-bit values.
+int EvalNNUE(struct Board * b, struct Accumulator * acc)
+{
+    PROFILE_ZONE(ZONE_EVAL);
+
+    alignas(64) uint8_t input[2 * NNUE_HIDDEN];
+    alignas(64) uint8_t hidden1[NNUE_L2];
+    alignas(64) uint8_t hidden2[NNUE_L3];
+
+    // The side to move's half comes first.
+    ClippedReLU(acc->values[b->side], input);
+    ClippedReLU(acc->values[!b->side], input + NNUE_HIDDEN);
+
+    Affine(input, 2 * NNUE_HIDDEN, &net.l1weights[0][0], net.l1bias, hidden1, NNUE_L2);
+    Affine(hidden1, NNUE_L2, &net.l2weights[0][0], net.l2bias, hidden2, NNUE_L3);
+
+    return max(-NNUE_MAXEVAL, min(NNUE_MAXEVAL, (net.outbias + Dot(hidden2, net.outweights, NNUE_L3)) / NNUE_SCALE));
+}
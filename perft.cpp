@@ -23,29 +23,51 @@
  */
 
 #include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "board.h"
 #include "functions.h"
 
 uint64_t Perft(struct Board * b, int depth)
 {
-    struct Sort s;
-    struct Move m;
+    struct Move moves[MAX_MOVES], m;
     struct Undo u;
-    struct Board c;
-    int movecount, i, j;
-    uint64_t nodes = 0, tmp;
+    int movecount, i;
+    uint64_t nodes = 0;
 
     if (depth == 0) {
         return 1;
     }
 
-    struct Move tmpmove;
-    tmpmove.from = tmpmove.dest = 0;
-    InitSort(b, &s, tmpmove);
+    // Move order doesn't matter here, so skip scoring and sorting.
+    if (IsInCheck(b)) {
+        movecount = GenerateEvasions(b, moves, 0);
+    } else {
+        movecount = GenerateCaptures(b, moves, 0);
+        movecount = GenerateQuiets(b, moves, movecount);
+    }
 
-    while (NextMove(&s, &m)) {
+    for (i = 0; i < movecount; i++) {
+        m = moves[i];
 
+#ifdef COPYMAKE
+        struct Board c = *b;
+
+        MakeMove(&c, &u, m);
+
+        if (IsIllegal(&c))
+            continue;
+
+        nodes += Perft(&c, depth - 1);
+#else
         MakeMove(b, &u, m);
 
         if (IsIllegal(b)) {
@@ -53,9 +75,10 @@ uint64_t Perft(struct Board * b, int depth)
             continue;
         }
 
-        nodes += tmp = Perft(b, depth - 1);
+        nodes += Perft(b, depth - 1);
 
         UnmakeMove(b, &u, m);
+#endif
     }
 
     return nodes;
@@ -63,22 +86,24 @@ uint64_t Perft(struct Board * b, int depth)
 
 uint64_t Divide(struct Board * b, int depth)
 {
-    struct Sort s;
-    struct Move m;
+    struct Move moves[MAX_MOVES], m;
     struct Undo u;
-    struct Board c;
-    int movecount, i, j;
+    int movecount, i;
     uint64_t nodes = 0, tmp;
 
     if (depth == 0) {
         return 1;
     }
 
-    struct Move tmpmove;
-    tmpmove.from = tmpmove.dest = 0;
-    InitSort(b, &s, tmpmove);
+    if (IsInCheck(b)) {
+        movecount = GenerateEvasions(b, moves, 0);
+    } else {
+        movecount = GenerateCaptures(b, moves, 0);
+        movecount = GenerateQuiets(b, moves, movecount);
+    }
 
-    while (NextMove(&s, &m)) {
+    for (i = 0; i < movecount; i++) {
+        m = moves[i];
 
         MakeMove(b, &u, m);
 
@@ -98,3 +123,265 @@ uint64_t Divide(struct Board * b, int depth)
 
     return nodes;
 }
+
+// Perft by a second route: strictly legal moves, counted in bulk on the
+// last ply. A disagreement with Perft points at one of the generators.
+uint64_t PerftLegal(struct Board * b, int depth)
+{
+    struct Move moves[MAX_MOVES];
+    struct Undo u;
+    int movecount, i;
+    uint64_t nodes = 0;
+
+    if (depth == 0)
+        return 1;
+
+    movecount = GenerateLegal(b, moves, 0);
+
+    if (depth == 1)
+        return movecount;
+
+    for (i = 0; i < movecount; i++) {
+        MakeMove(b, &u, moves[i]);
+        nodes += PerftLegal(b, depth - 1);
+        UnmakeMove(b, &u, moves[i]);
+    }
+
+    return nodes;
+}
+
+// A position of a perft suite, with the counts expected at each depth.
+struct SuiteEntry {
+    std::string fen;
+    std::vector< std::pair<int, uint64_t> > counts;
+    int line;
+};
+
+struct Suite {
+    std::vector<struct SuiteEntry> entries;
+    std::atomic<size_t> next;
+    std::mutex lock;
+    uint64_t nodes;
+    int failures;
+};
+
+enum { DIVIDE_AGREE, DIVIDE_DIFFER, DIVIDE_NOT_LEGAL, DIVIDE_MISSING };
+
+// A move of a divide, with its subtree count by each perft route.
+struct DivideEntry {
+    struct Move m;
+    uint64_t count, legalnodes;
+    int status;
+};
+
+// Divide a failing position by both perft routes, marking the moves whose
+// subtree counts differ, or that only one route generates. Returns the
+// number of marked moves.
+static int DivideDiff(struct Board * b, int depth, std::vector<struct DivideEntry>& divide)
+{
+    struct Move pseudo[MAX_MOVES], legal[MAX_MOVES];
+    struct DivideEntry d;
+    struct Undo u;
+    int pseudocount, legalcount, i, j, differ = 0;
+
+    if (IsInCheck(b)) {
+        pseudocount = GenerateEvasions(b, pseudo, 0);
+    } else {
+        pseudocount = GenerateCaptures(b, pseudo, 0);
+        pseudocount = GenerateQuiets(b, pseudo, pseudocount);
+    }
+
+    legalcount = GenerateLegal(b, legal, 0);
+
+    for (i = 0; i < pseudocount; i++) {
+        MakeMove(b, &u, pseudo[i]);
+
+        if (IsIllegal(b)) {
+            UnmakeMove(b, &u, pseudo[i]);
+            continue;
+        }
+
+        d.m = pseudo[i];
+        d.count = Perft(b, depth - 1);
+        d.legalnodes = PerftLegal(b, depth - 1);
+
+        UnmakeMove(b, &u, pseudo[i]);
+
+        for (j = 0; j < legalcount && legal[j] != pseudo[i]; j++)
+            ;
+
+        if (j == legalcount) {
+            d.status = DIVIDE_NOT_LEGAL;
+        } else if (d.count != d.legalnodes) {
+            d.status = DIVIDE_DIFFER;
+        } else {
+            d.status = DIVIDE_AGREE;
+        }
+
+        if (d.status != DIVIDE_AGREE)
+            differ++;
+
+        divide.push_back(d);
+    }
+
+    for (j = 0; j < legalcount; j++) {
+        for (i = 0; i < pseudocount && pseudo[i] != legal[j]; i++)
+            ;
+
+        if (i == pseudocount) {
+            MakeMove(b, &u, legal[j]);
+            d.legalnodes = PerftLegal(b, depth - 1);
+            UnmakeMove(b, &u, legal[j]);
+
+            d.m = legal[j];
+            d.count = 0;
+            d.status = DIVIDE_MISSING;
+            differ++;
+
+            divide.push_back(d);
+        }
+    }
+
+    return differ;
+}
+
+// Print a divide. If the two routes agree on every move, it can still be
+// compared with another engine's.
+static void PrintDivide(struct Board * b, int depth, const std::vector<struct DivideEntry>& divide, int differ)
+{
+    printf("  divide %d, perft against legal perft:\n", depth);
+
+    for (const struct DivideEntry& d : divide) {
+        printf("    ");
+        PrintMove(b, d.m);
+
+        switch (d.status) {
+        case DIVIDE_NOT_LEGAL:
+            printf(" %llu <- not legal\n", d.count);
+            break;
+        case DIVIDE_DIFFER:
+            printf(" %llu <- legal perft %llu\n", d.count, d.legalnodes);
+            break;
+        case DIVIDE_MISSING:
+            printf(" <- missing, legal perft %llu\n", d.legalnodes);
+            break;
+        default:
+            printf(" %llu\n", d.count);
+            break;
+        }
+    }
+
+    if (!differ)
+        printf("  the two routes agree: the error is in code they share, or in the expected count\n");
+}
+
+static void SuiteWorker(struct Suite * suite)
+{
+    struct Board b;
+    char fen[512];
+    size_t index;
+
+    while ((index = suite->next++) < suite->entries.size()) {
+        struct SuiteEntry& e = suite->entries[index];
+        std::vector<struct DivideEntry> divide;
+        uint64_t nodes = 0, result = 0, expected = 0;
+        int start, elapsed, depth = 0, differ = 0;
+        bool ok = true;
+
+        snprintf(fen, sizeof(fen), "%s", e.fen.c_str());
+        ParseFEN(&b, fen);
+
+        start = ReadClock();
+
+        for (const std::pair<int, uint64_t>& c : e.counts) {
+            depth = c.first;
+            expected = c.second;
+            result = Perft(&b, depth);
+            nodes += result;
+
+            if (result != expected) {
+                ok = false;
+                break;
+            }
+        }
+
+        elapsed = ReadClock() - start;
+
+        // The divide is slow, so it runs before the lock is taken, leaving
+        // only the output and the totals to the lock.
+        if (!ok)
+            differ = DivideDiff(&b, depth, divide);
+
+        std::lock_guard<std::mutex> guard(suite->lock);
+
+        suite->nodes += nodes;
+
+        if (ok) {
+            printf("Position %zu OK: %llu nodes in %d msec, %llu nps\n", index + 1, nodes, elapsed,
+                   nodes * 1000 / (elapsed ? elapsed : 1));
+        } else {
+            suite->failures++;
+
+            printf("Position %zu FAILED (line %d): depth %d expected %llu, got %llu\n", index + 1, e.line,
+                   depth, expected, result);
+            printf("  %s\n", e.fen.c_str());
+
+            PrintDivide(&b, depth, divide, differ);
+        }
+    }
+}
+
+// Check every count of an EPD perft suite ("epd <fen>" lines, each followed
+// by "perft <depth> <count>" lines), spreading the positions over threads.
+// Returns the number of failing positions, or -1 if the suite can't be read.
+int PerftSuite(const char * path, int threads)
+{
+    static struct Suite suite;
+    std::vector<std::thread> workers;
+    char line[512];
+    uint64_t count;
+    int depth, start, elapsed, lineno = 0, i;
+    FILE * f = fopen(path, "r");
+
+    if (f == NULL) {
+        printf("Error (cannot open perft suite): %s\n", path);
+        return -1;
+    }
+
+    suite.entries.clear();
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (!strncmp(line, "epd ", 4)) {
+            suite.entries.push_back(SuiteEntry());
+            suite.entries.back().fen = line + 4;
+            suite.entries.back().line = lineno;
+        } else if (sscanf(line, "perft %d %llu", &depth, &count) == 2 && !suite.entries.empty()) {
+            suite.entries.back().counts.push_back(std::make_pair(depth, count));
+        }
+    }
+
+    fclose(f);
+
+    suite.next = 0;
+    suite.nodes = 0;
+    suite.failures = 0;
+
+    start = ReadClock();
+
+    for (i = 0; i < threads; i++)
+        workers.push_back(std::thread(SuiteWorker, &suite));
+
+    for (std::thread& t : workers)
+        t.join();
+
+    elapsed = ReadClock() - start;
+
+    printf("Suite: %zu of %zu positions OK, %llu nodes in %d msec, %llu nps\n",
+           suite.entries.size() - suite.failures, suite.entries.size(), suite.nodes, elapsed,
+           suite.nodes * 1000 / (elapsed ? elapsed : 1));
+
+    return suite.failures;
+}
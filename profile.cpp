@@ -0,0 +1,101 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Dan Ravensloft <dan.ravensloft@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <mutex>
+
+#include "board.h"
+#include "functions.h"
+#include "profile.h"
+
+#ifdef PROFILE
+
+static const char * zonenames[ZONE_COUNT] = {
+    "GenerateCaptures", "GenerateQuiets", "MakeMove", "Eval", "SEE", "ReadTT", "IsAttacked",
+};
+
+thread_local struct ZoneCounters zonecounters;
+
+// Each thread's counters are added in here when it finishes a search, as
+// thread-local counters can't be read from other threads.
+static struct ZoneCounters totals;
+static std::mutex totalslock;
+static uint64_t laststart = __rdtsc();
+
+void ProfileFlush()
+{
+    std::lock_guard<std::mutex> guard(totalslock);
+    int zone;
+
+    for (zone = 0; zone < ZONE_COUNT; zone++) {
+        totals.calls[zone] += zonecounters.calls[zone];
+        totals.cycles[zone] += zonecounters.cycles[zone];
+    }
+
+    memset(&zonecounters, 0, sizeof(zonecounters));
+}
+
+// Print the zones since the last report, and start again. The share is of
+// the cycles elapsed since then, so with several threads searching the
+// shares can add up to more than 100%.
+void ProfileReport()
+{
+    uint64_t elapsed;
+    int zone;
+
+    ProfileFlush();
+
+    std::lock_guard<std::mutex> guard(totalslock);
+
+    elapsed = __rdtsc() - laststart;
+
+    printf("%-18s %14s %16s %12s %8s\n", "Zone", "Calls", "Cycles", "Cycles/call", "Share");
+
+    for (zone = 0; zone < ZONE_COUNT; zone++) {
+        printf("%-18s %14llu %16llu %12.1f %7.2f%%\n", zonenames[zone], totals.calls[zone], totals.cycles[zone],
+               totals.calls[zone] ? (double)totals.cycles[zone] / totals.calls[zone] : 0.0,
+               elapsed ? 100.0 * totals.cycles[zone] / elapsed : 0.0);
+    }
+
+    printf("%-18s %14s %16llu\n", "Elapsed", "", elapsed);
+
+    memset(&totals, 0, sizeof(totals));
+    laststart = __rdtsc();
+}
+
+#else
+
+void ProfileFlush()
+{
+}
+
+void ProfileReport()
+{
+    printf("Error (not a profiling build): build with make PROFILE=1\n");
+}
+
+#endif // PROFILE
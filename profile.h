@@ -0,0 +1,77 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Dan Ravensloft <dan.ravensloft@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+// Profiling zones, built in with PROFILE=1 (x86 only). PROFILE_ZONE times
+// the rest of its scope with rdtsc, into counters of the calling thread.
+// In other builds it expands to nothing.
+
+enum {
+    ZONE_GENERATE_CAPTURES,
+    ZONE_GENERATE_QUIETS,
+    ZONE_MAKE_MOVE,
+    ZONE_EVAL,
+    ZONE_SEE,
+    ZONE_READ_TT,
+    ZONE_IS_ATTACKED,
+    ZONE_COUNT
+};
+
+#ifdef PROFILE
+
+#include <x86intrin.h>
+
+struct ZoneCounters {
+    uint64_t calls[ZONE_COUNT];
+    uint64_t cycles[ZONE_COUNT];
+};
+
+extern thread_local struct ZoneCounters zonecounters;
+
+struct ProfileZone {
+    int zone;
+    uint64_t start;
+
+    ProfileZone(int z) : zone(z), start(__rdtsc()) {}
+
+    ~ProfileZone()
+    {
+        zonecounters.calls[zone]++;
+        zonecounters.cycles[zone] += __rdtsc() - start;
+    }
+};
+
+#define PROFILE_ZONE(zone) struct ProfileZone profilezone(zone)
+
+#else
+
+#define PROFILE_ZONE(zone)
+
+#endif // PROFILE
+
+#endif // PROFILE_H
@@ -27,149 +27,450 @@
 #include "board.h"
 #include "functions.h"
 
-int nodes;
+// The number of best lines Think reports.
+int multipv = 1;
 
-int Quies(struct Board * b, int alpha, int beta)
+void InitSearch(struct SearchContext * ctx, struct Board * b, struct KeyStack * game)
 {
-    struct Move m;
+    ctx->b = *b;
+
+    // Defaults, which callers may override once the search is set up.
+    ctx->params = params;
+    ctx->tt = &tt;
+    ctx->nodelimit = 0;
+    ctx->multipv = 1;
+
+    // The root's accumulators; the others follow from them move by move.
+    if (NNUEActive())
+        RefreshNNUE(&ctx->b, &ctx->acc[1]);
+
+#ifdef COPYMAKE
+    ctx->stack[1].board = ctx->b;
+#endif
+
+    ctx->stack[1].first = 0;
+
+    // The game stack ends with the root, which sits at ply 1.
+    memcpy(ctx->keys.keys, game->keys, game->count * sizeof(uint64_t));
+    ctx->keys.count = max(game->count - 1, 0);
+    ctx->keys.keys[ctx->keys.count] = b->hash;
+
+    ctx->nodes = ctx->qnodes = 0;
+    ctx->first = ctx->cuts = 0;
+    ctx->stop.store(0, std::memory_order_relaxed);
+    ctx->ponderhit = false;
+    ctx->excludedcount = 0;
+
+    ReduceHistory(ctx);
+}
+
+// The board a node at this ply works on. With copy-make every ply has its
+// own board copied from its parent, otherwise all plies share one board
+// that moves are made and unmade on.
+static inline struct Board * BoardAt(struct SearchContext * ctx, int ply)
+{
+#ifdef COPYMAKE
+    return &ctx->stack[ply].board;
+#else
+    return &ctx->b;
+#endif
+}
+
+// Derive the child's accumulators once the move is on its board.
+static inline void PlayNNUE(struct SearchContext * ctx, struct Board * c, struct Undo * u, struct Move m, int ply)
+{
+    struct DirtyPiece d[3];
+    int count;
+
+    if (NNUEActive()) {
+        count = DirtyPieces(c, u, m, d);
+        UpdateNNUE(c, d, count, &ctx->acc[ply], &ctx->acc[ply + 1]);
+    }
+}
+
+// Play a move from the board at this ply, returning the child's board.
+static inline struct Board * Play(struct SearchContext * ctx, struct Undo * u, struct Move m, int ply)
+{
+#ifdef COPYMAKE
+    struct Board * c = BoardAt(ctx, ply + 1);
+
+    *c = *BoardAt(ctx, ply);
+    MakeMove(c, u, m);
+    PlayNNUE(ctx, c, u, m, ply);
+
+    return c;
+#else
+    struct Board * b = BoardAt(ctx, ply);
+
+    MakeMove(b, u, m);
+    PlayNNUE(ctx, b, u, m, ply);
+
+    return b;
+#endif
+}
+
+static inline void Unplay(struct SearchContext * ctx, struct Undo * u, struct Move m, int ply)
+{
+#ifndef COPYMAKE
+    UnmakeMove(BoardAt(ctx, ply), u, m);
+#endif
+}
+
+static inline void PlayNull(struct SearchContext * ctx, struct Undo * u, int ply)
+{
+#ifdef COPYMAKE
+    struct Board * c = BoardAt(ctx, ply + 1);
+
+    *c = *BoardAt(ctx, ply);
+    MakeNullMove(c, u);
+#else
+    MakeNullMove(BoardAt(ctx, ply), u);
+#endif
+
+    if (NNUEActive())
+        ctx->acc[ply + 1] = ctx->acc[ply];
+}
+
+static inline void UnplayNull(struct SearchContext * ctx, struct Undo * u, int ply)
+{
+#ifndef COPYMAKE
+    UnmakeNullMove(BoardAt(ctx, ply), u);
+#endif
+}
+
+// The network's score if it is in use, which reads this ply's accumulators,
+// otherwise the hand-written evaluation's.
+static inline int Evaluate(struct SearchContext * ctx, struct Board * b, int ply)
+{
+    return NNUEActive() ? EvalNNUE(b, &ctx->acc[ply]) : Eval(b);
+}
+
+// A ponder search runs on an infinite clock until the expected move is
+// played. Then the real clock is posted, and it is switched to here, on the
+// searching thread.
+static inline void CheckTime(struct SearchContext * ctx)
+{
+    if (ctx->ponderhit.load(std::memory_order_acquire)) {
+        ctx->clock = ctx->hitclock;
+        ctx->ponderhit.store(false, std::memory_order_relaxed);
+    }
+
+    if (HardTimeout(&ctx->clock) || (ctx->nodelimit && ctx->nodes >= ctx->nodelimit))
+        ctx->stop.store(1, std::memory_order_relaxed);
+}
+
+// Record this node's key, and look for an earlier occurrence of it since
+// the last irreversible move.
+static bool IsDraw(struct SearchContext * ctx, struct Board * b, int ply)
+{
+    int top = ctx->keys.count + ply - 1;
+    uint64_t * keys = ctx->keys.keys;
+    int i;
+
+    keys[top] = b->hash;
+
+    if (b->fifty >= 100)
+        return true;
+
+    for (i = 4; i <= b->fifty && i <= top; i += 2) {
+        if (keys[top - i] == b->hash)
+            return true;
+    }
+
+    return false;
+}
+
+int Quies(struct SearchContext * ctx, int alpha, int beta, int ply, int depth)
+{
+    struct Board * b = BoardAt(ctx, ply);
+    struct Move m, ttm, bestmove;
+    struct CheckInfo ci;
     struct Sort s;
     struct Undo u;
 
-    int val, best;
+    int val, best, oldalpha = alpha;
+    int incheck = IsInCheck(b);
+
+    ctx->nodes++;
+    ctx->qnodes++;
 
-    nodes++;
+    if (IsDraw(ctx, b, ply))
+        return 0;
 
-    best = Eval(b);
+    // Quiescence entries have depth 0, so any entry for this position is deep enough.
+    if ((val = ReadTT(ctx->tt, b, &ttm, 0, alpha, beta, ply)) != 11000)
+        return val;
 
-    if (best >= beta)
+    best = Evaluate(ctx, b, ply);
+
+    if (ply >= MAX_PLY - 1)
         return best;
+
+    // In check there is no standing pat: every evasion gets searched.
+    if (incheck)
+        best = -MATE + ply;
+
+    if (best >= beta) {
+        WriteTT(ctx->tt, b, 0, best, hashfBETA, Move(), ply);
+        return best;
+    }
+
+    // Delta pruning: not even winning a queen would bring us back to alpha.
+    if (ctx->params.delta && !incheck && best + piecevals[QUEEN][0] + ctx->params.delta_margin < alpha)
+        return best;
+
     if (best > alpha)
         alpha = best;
 
-    InitSortQuies(b, &s);
+    // On the first ply quiet checks are tried too.
+    if (ctx->params.qchecks && depth == 0 && !incheck) {
+        InitCheckInfo(b, &ci);
+        InitSortQuies(b, &s, ttm, &ci, ctx, ply);
+    } else {
+        InitSortQuies(b, &s, ttm, NULL, ctx, ply);
+    }
+
+    bestmove = Move();
 
     while (NextMove(&s, &m)) {
 
-        MakeMove(b, &u, m);
+        // Delta pruning: this capture can't bring us back to alpha.
+        if (ctx->params.delta && !incheck && m.type() == CAPTURE &&
+                best + piecevals[b->squares[m.dest]][0] + ctx->params.delta_margin <= alpha)
+            continue;
 
-        if (IsIllegal(b)) {
-            UnmakeMove(b, &u, m);
+        // SEE pruning: losing captures are refuted by the recapture.
+        if (ctx->params.qsee && !incheck && !SeeGE(b, m, 0))
+            continue;
+
+        if (IsIllegal(Play(ctx, &u, m, ply))) {
+            Unplay(ctx, &u, m, ply);
             continue;
         }
 
-        val = -Quies(b, -beta, -alpha);
+        val = -Quies(ctx, -beta, -alpha, ply + 1, depth - 1);
 
-        UnmakeMove(b, &u, m);
+        Unplay(ctx, &u, m, ply);
 
-        if (val >= beta)
+        if (ctx->stop.load(std::memory_order_relaxed))
+            return best;
+
+        if (val >= beta) {
+            WriteTT(ctx->tt, b, 0, val, hashfBETA, m, ply);
             return val;
+        }
+
+        if (val > best) {
+            best = val;
+            bestmove = m;
+        }
 
         if (val > alpha)
             alpha = val;
-
-        if (val > best)
-            best = val;
     }
 
+    WriteTT(ctx->tt, b, 0, best, (best > oldalpha) ? hashfEXACT : hashfALPHA, bestmove, ply);
+
     return best;
 }
 
-int first, cuts;
-int stopsearch;
+struct SearchParams params = {
+    1, 3, 120,  // Reverse futility pruning
+    1, 2, 150,  // Futility pruning
+    1, 2, 300,  // Razoring
+    1, 3, 4,    // Late move pruning
+    1, 4, 60,   // SEE pruning
+    1, 200,     // Delta pruning
+    1,          // Quiescence SEE pruning
+    1           // Quiescence checks
+};
+
+static inline bool IsQuiet(struct Move m)
+{
+    return m.type() == QUIET || m.type() == DOUBLE_PUSH || m.type() == CASTLE;
+}
+
+// Put m in front of the child's line, in this ply's row of the PV table.
+static inline void UpdatePV(struct SearchContext * ctx, int ply, struct Move m)
+{
+    struct Move * line = ctx->pv[ply];
+    struct Move * child = ctx->pv[ply + 1];
+    int i;
+
+    line[ply] = m;
+
+    for (i = ply + 1; i < ctx->pvlen[ply + 1]; i++)
+        line[i] = child[i];
 
-int Search(struct Board * b, int depth, int alpha, int beta, int ply, struct PV * pv)
+    ctx->pvlen[ply] = ctx->pvlen[ply + 1];
+}
+
+static inline bool IsExcluded(struct SearchContext * ctx, struct Move m)
 {
+    int i;
+
+    for (i = 0; i < ctx->excludedcount; i++) {
+        if (ctx->excluded[i] == m)
+            return true;
+    }
+
+    return false;
+}
+
+// Node types. PV nodes are searched with an open window and collect a
+// principal variation; non-PV nodes get a null window and may be pruned.
+// The root is a PV node that also reports its best move when it fails high.
+enum { NODE_NONPV, NODE_PV, NODE_ROOT };
+
+// Search is instantiated per node type, so the PV bookkeeping and root-only
+// code drop out of the non-PV instantiation. PV nodes build their line in
+// row ply of the context's PV table.
+template <int node>
+static int Search(struct SearchContext * ctx, int depth, int alpha, int beta, int ply)
+{
+    const bool pvnode = node != NODE_NONPV;
+
+    struct Board * b = BoardAt(ctx, ply);
+    struct Board * child;
     struct Move m, bestmove;
+    struct CheckInfo ci;
     struct Sort s;
     struct Undo u;
-    struct PV childpv;
-    int pvnode = (alpha != beta-1);
     int incheck = IsInCheck(b);
-    int eval = Eval(b);
+    int eval = Evaluate(ctx, b, ply);
 
     int val, moves = 0;
 
     int flag = hashfALPHA;
 
-    nodes++;
+    ctx->nodes++;
 
-    if (!(nodes & 1023) && ReadClock() >= (starttime + hardtimelimit)) {
-        stopsearch = 1;
-        return Eval(b);
-    }
+    if (pvnode)
+        ctx->pvlen[ply] = ply;
 
-    if (depth <= 0) {
-        pv->count = 0;
-        return Quies(b, alpha, beta);
-    }
+    if (!(ctx->nodes & 1023))
+        CheckTime(ctx);
 
-    m.from = m.dest = 0;
-    bestmove.from = bestmove.dest = 0;
+    if (ctx->stop.load(std::memory_order_relaxed) || ply >= MAX_PLY - 1)
+        return eval;
+
+    if (node != NODE_ROOT && IsDraw(ctx, b, ply))
+        return 0;
+
+    ctx->stack[ply].eval = eval;
+
+    if (depth <= 0)
+        return Quies(ctx, alpha, beta, ply, 0);
+
+    m = bestmove = Move();
 
     // Hash probe
-    CalculateHash(b);
+    if ((val = ReadTT(ctx->tt, b, &m, depth, alpha, beta, ply)) != 11000 && !pvnode)
+        return val;
+
+    // Reverse futility pruning: the static eval beats beta by a margin that
+    // a shallow search is unlikely to lose again.
+    if (ctx->params.rfp && depth <= ctx->params.rfp_depth && !incheck && !pvnode &&
+            beta > -9500 && beta < 9500 && eval - ctx->params.rfp_margin*depth >= beta) {
+        return eval;
+    }
 
-    if ((val = ReadTT(b, &m, depth, alpha, beta, ply)) != 11000) {
-        if (!pvnode) {
-            pv->count = 0;
+    // Razoring: the static eval is so far below alpha that only captures
+    // could save us, so let quiescence search decide.
+    if (ctx->params.razor && depth <= ctx->params.razor_depth && !incheck && !pvnode &&
+            eval + ctx->params.razor_margin*depth < alpha) {
+        val = Quies(ctx, alpha, beta, ply, 0);
+        if (val <= alpha)
             return val;
-        }
     }
 
     if (depth >= 2 && !incheck && eval >= beta && !pvnode && cnt(b->colors[b->side] & ~b->pawns()) > 3) {
 
-        b->side ^= 1;
+        PlayNull(ctx, &u, ply);
 
-        int fifty = b->fifty;
-        int ep = b->ep;
+        ctx->stack[ply].move = Move();
+        ctx->stack[ply + 1].first = ctx->stack[ply].first;
 
-        b->fifty = 0;
-        b->ep = INVALID;
+        val = -Search<NODE_NONPV>(ctx, depth - 4, -beta, -beta+1, ply+1);
 
-        val = -Search(b, depth - 4, -beta, -beta+1, ply+1, &childpv);
-
-        b->ep = ep;
-        b->fifty = fifty;
-        b->side ^= 1;
+        UnplayNull(ctx, &u, ply);
 
         if (val >= beta)
             return val;
     }
 
-    InitSort(b, &s, m);
+    // Futility pruning: quiet moves are unlikely to raise the eval above alpha.
+    int futile = ctx->params.fut && depth <= ctx->params.fut_depth && !incheck && !pvnode &&
+                 alpha > -9500 && eval + ctx->params.fut_margin*depth <= alpha;
+
+    // Late move pruning: past this many moves, quiets are unlikely to matter.
+    int lmpcount = (ctx->params.lmp && depth <= ctx->params.lmp_depth && !incheck && !pvnode) ?
+                   ctx->params.lmp_count + depth*depth : 256;
+
+    // SEE pruning: quiet moves that hang material are unlikely to be good.
+    int seeprune = ctx->params.see && depth <= ctx->params.see_depth && !incheck && !pvnode;
+
+    InitCheckInfo(b, &ci);
+
+    InitSort(b, &s, m, ctx, ply);
 
     while (NextMove(&s, &m)) {
 
-        MakeMove(b, &u, m);
+        if (node == NODE_ROOT && IsExcluded(ctx, m))
+            continue;
+
+        int givescheck = GivesCheck(b, &ci, m);
+
+        // Once a legal move has been found, pruned quiets don't have to
+        // be played at all. They still count as moves for late move pruning.
+        if (moves && IsQuiet(m) && !givescheck &&
+                (futile || moves >= lmpcount ||
+                 (seeprune && !SeeGE(b, m, -ctx->params.see_margin*depth)))) {
+            moves++;
+            continue;
+        }
+
+        child = Play(ctx, &u, m, ply);
 
-        if (IsIllegal(b)) {
-            UnmakeMove(b, &u, m);
+        if (IsIllegal(child)) {
+            Unplay(ctx, &u, m, ply);
             continue;
         }
 
         moves++;
 
-        if (flag == hashfALPHA)
-            val = -Search(b, depth - 1, -beta, -alpha, ply + 1, &childpv);
+        ctx->stack[ply].move = m;
+
+        if (pvnode && moves == 1)
+            val = -Search<NODE_PV>(ctx, depth - 1, -beta, -alpha, ply + 1);
         else {
-            val = -Search(b, depth - 1, -alpha-1, -alpha, ply + 1, &childpv);
-            if (val > alpha && val < beta) {
-                val = -Search(b, depth - 1, -beta, -alpha, ply + 1, &childpv);
+            val = -Search<NODE_NONPV>(ctx, depth - 1, -alpha-1, -alpha, ply + 1);
+            if (pvnode && val > alpha && val < beta) {
+                val = -Search<NODE_PV>(ctx, depth - 1, -beta, -alpha, ply + 1);
             }
         }
 
-        UnmakeMove(b, &u, m);
+        Unplay(ctx, &u, m, ply);
 
-        if (stopsearch) {
-            return Eval(b);
+        if (ctx->stop.load(std::memory_order_relaxed)) {
+            return Evaluate(ctx, b, ply);
         }
 
         if (val >= beta) {
             if (moves == 1)
-                first++;
-            cuts++;
+                ctx->first++;
+            ctx->cuts++;
+
+            if (IsQuiet(m))
+                UpdateHistory(ctx, b->side, m, depth);
+
+            // Keep the refutation so a root fail-high can be reported.
+            if (node == NODE_ROOT) {
+                ctx->pv[ply][ply] = m;
+                ctx->pvlen[ply] = ply + 1;
+            }
 
-            WriteTT(b, depth, val, hashfBETA, m, ply);
+            WriteTT(ctx->tt, b, depth, val, hashfBETA, m, ply);
 
             return beta;
         }
@@ -177,9 +478,8 @@ int Search(struct Board * b, int depth, int alpha, int beta, int ply, struct PV
         if (val > alpha) {
             alpha = val;
 
-            pv->moves[0] = m;
-            memcpy(pv->moves + 1, childpv.moves, childpv.count * sizeof(struct Move));
-            pv->count = childpv.count + 1;
+            if (pvnode)
+                UpdatePV(ctx, ply, m);
 
             bestmove = m;
             flag = hashfEXACT;
@@ -194,7 +494,175 @@ int Search(struct Board * b, int depth, int alpha, int beta, int ply, struct PV
         }
     }
 
-    WriteTT(b, depth, alpha, flag, bestmove, ply);
+    // A root search with moves left out doesn't score the root position.
+    if (node != NODE_ROOT || !ctx->excludedcount)
+        WriteTT(ctx->tt, b, depth, alpha, flag, bestmove, ply);
 
     return alpha;
 }
+
+// Copy the root line out of the PV table. Lines cut short at the horizon
+// or by a fail high are extended with hash moves, as long as they are
+// legal and don't repeat a position.
+static void GetPV(struct SearchContext * ctx, struct PV * pv)
+{
+    struct Board b = ctx->b;
+    struct Move moves[MAX_MOVES], m;
+    struct Undo u;
+    uint64_t seen[MAX_PLY];
+    int i, count;
+
+    pv->count = 0;
+
+    for (i = 1; i < ctx->pvlen[1]; i++) {
+        seen[pv->count] = b.hash;
+        pv->moves[pv->count++] = ctx->pv[1][i];
+        MakeMove(&b, &u, ctx->pv[1][i]);
+    }
+
+    while (pv->count < MAX_PLY - 1) {
+        m = ProbeTTMove(ctx->tt, &b);
+
+        if (m == Move())
+            break;
+
+        count = GenerateLegal(&b, moves, 0);
+
+        for (i = 0; i < count && moves[i] != m; i++)
+            ;
+
+        if (i == count)
+            break;
+
+        seen[pv->count] = b.hash;
+
+        for (i = 0; i < pv->count && seen[i] != b.hash; i++)
+            ;
+
+        if (i < pv->count)
+            break;
+
+        pv->moves[pv->count++] = m;
+        MakeMove(&b, &u, m);
+    }
+}
+
+static void PrintThinking(struct SearchContext * ctx, int depth, int score, struct PV * pv, const char * bound)
+{
+    struct Board * b = &ctx->b;
+    int i;
+
+    printf("%d %d %d %d ", depth, score, Elapsed(&ctx->clock)/10, ctx->nodes);
+
+    for (i = 0; i < pv->count; i++) {
+        PrintMove(b, pv->moves[i]);
+        printf(" ");
+    }
+
+    printf("%s\n", bound);
+}
+
+// Search the root with an aspiration window around the line's score from
+// the previous iteration, widening it until the score falls inside.
+static int Aspiration(struct SearchContext * ctx, int depth, int score, struct PV * pv, int post)
+{
+    int alpha, beta, delta = 25;
+    int val;
+
+    if (depth >= 4) {
+        alpha = max(score - delta, -10000);
+        beta = min(score + delta, +10000);
+    } else {
+        alpha = -10000;
+        beta = +10000;
+    }
+
+    while (1) {
+        val = Search<NODE_ROOT>(ctx, depth, alpha, beta, 1);
+
+        GetPV(ctx, pv);
+
+        if (ctx->stop.load(std::memory_order_relaxed))
+            break;
+
+        if (val <= alpha) {
+            if (post)
+                PrintThinking(ctx, depth, val, pv, "?");
+
+            beta = (alpha + beta) / 2;
+            alpha = max(val - delta, -10000);
+        } else if (val >= beta) {
+            if (post)
+                PrintThinking(ctx, depth, val, pv, "!");
+
+            beta = min(val + delta, +10000);
+        } else {
+            break;
+        }
+
+        delta += delta;
+    }
+
+    return val;
+}
+
+// Iterative deepening. Each iteration finds the best multipv lines in turn,
+// leaving the moves heading the lines already found out of the root search.
+// The lines share the hash table, so later ones reuse the earlier ones' work.
+int Think(struct SearchContext * ctx, int maxdepth, struct PV * pv, int post)
+{
+    struct PV linepv;
+    struct Move moves[MAX_MOVES];
+    int scores[MAX_MOVES] = { 0 };
+    int depth, line, lines, val;
+
+    pv->count = 0;
+
+    AgeTT(ctx->tt);
+
+    // There can't be more lines than legal moves.
+    lines = max(min(ctx->multipv, GenerateLegal(&ctx->b, moves, 0)), 1);
+
+    for (depth = 1; depth <= maxdepth; depth++) {
+
+        ctx->excludedcount = 0;
+
+        for (line = 0; line < lines; line++) {
+            val = Aspiration(ctx, depth, scores[line], &linepv, post);
+
+            if (ctx->stop.load(std::memory_order_relaxed))
+                break;
+
+            scores[line] = val;
+
+            if (line == 0)
+                *pv = linepv;
+
+            if (post)
+                PrintThinking(ctx, depth, scores[line], &linepv, "");
+
+            // A line without a move leaves nothing to exclude, and the
+            // next line would only search the same moves again.
+            if (!linepv.count)
+                break;
+
+            ctx->excluded[ctx->excludedcount++] = linepv.moves[0];
+        }
+
+        ctx->excludedcount = 0;
+
+        // A partial iteration is only trusted if we have nothing better.
+        if (ctx->stop.load(std::memory_order_relaxed)) {
+            if (!pv->count)
+                *pv = linepv;
+            break;
+        }
+
+        if (!NextIteration(&ctx->clock, depth, pv->moves[0], scores[0]))
+            break;
+    }
+
+    ProfileFlush();
+
+    return scores[0];
+}
@@ -27,6 +27,7 @@
 
 #include "board.h"
 #include "functions.h"
+#include "profile.h"
 
 static uint64_t GetXRays(struct Board * b, uint64_t occ, int sq)
 {
@@ -42,32 +43,36 @@ static uint64_t GetXRays(struct Board * b, uint64_t occ, int sq)
     return rooksqueens | bishsqueens;
 }
 
-static uint64_t AttacksTo(struct Board * b, int square, int side)
+// All pieces of both sides attacking a square, given an occupancy.
+static uint64_t AttacksTo(struct Board * b, int square, uint64_t occ)
 {
     assert(b != NULL);
     assert(square >= 0 && square <= 63);
-    assert(side == WHITE || side == BLACK);
 
     uint64_t pawns, knights, bishopsqueens, rooksqueens, kings;
 
-    pawns = b->pawns() & b->colors[side];
-    pawns &= PawnAttacks(!side, square);
+    pawns = b->pawns() & b->colors[WHITE] & PawnAttacks(BLACK, square);
+    pawns |= b->pawns() & b->colors[BLACK] & PawnAttacks(WHITE, square);
 
-    knights = b->knights() & b->colors[side];
-    knights &= KnightAttacks(square);
+    knights = b->knights() & KnightAttacks(square);
 
-    kings = b->kings() & b->colors[side];
-    kings &= KingAttacks(square);
+    kings = b->kings() & KingAttacks(square);
 
-    bishopsqueens = (b->bishops() | b->queens()) & b->colors[side];
-    bishopsqueens &= BishopAttacks(square, (b->colors[WHITE] | b->colors[BLACK]));
+    bishopsqueens = (b->bishops() | b->queens()) & BishopAttacks(square, occ);
 
-    rooksqueens = (b->rooks() | b->queens()) & b->colors[side];
-    rooksqueens &= RookAttacks(square, (b->colors[WHITE] | b->colors[BLACK]));
+    rooksqueens = (b->rooks() | b->queens()) & RookAttacks(square, occ);
 
     return pawns | knights | bishopsqueens | rooksqueens | kings;
 }
 
+// Pieces of a side pinned to their own king, and the pieces pinning them.
+static uint64_t Pinned(struct Board * b, int side, uint64_t * pinners)
+{
+    int king = lsb(b->kings() & b->colors[side]);
+
+    return SliderBlockers(b, king, b->colors[!side], pinners) & b->colors[side];
+}
+
 /* Most of this comes from the CPW - thanks Gerd! */
 static uint64_t GetLeastValuablePiece(struct Board * b, uint64_t bb, int colour, int * piece)
 {
@@ -82,6 +87,8 @@ static uint64_t GetLeastValuablePiece(struct Board * b, uint64_t bb, int colour,
 
 int SEE(struct Board * b, int from, int to, int cap, int att)
 {
+   PROFILE_ZONE(ZONE_SEE);
+
    assert(b != NULL);
    assert(from >= 0 && from <= 63);
    assert(to >= 0 && to <= 63);
@@ -98,7 +105,7 @@ int SEE(struct Board * b, int from, int to, int cap, int att)
    uint64_t mayXray = b->pieces[PAWN] | b->pieces[BISHOP] | b->pieces[ROOK] | b->pieces[QUEEN];
    uint64_t fromSet = 1ULL << from;
    uint64_t occ     = b->colors[WHITE] | b->colors[BLACK];
-   uint64_t attadef = AttacksTo(b, to, WHITE) | AttacksTo(b, to, BLACK);
+   uint64_t attadef = AttacksTo(b, to, occ);
    gain[d]     = seevals[cap];
 
    do {
@@ -118,3 +125,100 @@ int SEE(struct Board * b, int from, int to, int cap, int att)
 
    return gain[0];
 }
+
+// Does the move win at least threshold centipawns once all exchanges on
+// the destination square are played out? Unlike SEE() this stops as soon
+// as the answer is known.
+bool SeeGE(struct Board * b, struct Move m, int threshold)
+{
+    PROFILE_ZONE(ZONE_SEE);
+
+    assert(b != NULL);
+
+    int from = m.from, to = m.dest, type = m.type();
+    int stm, swap, res, captured, piece;
+    uint64_t occ, attackers, stmattackers, bb;
+    uint64_t pinned[2], pinners[2];
+
+    if (type == CASTLE)
+        return 0 >= threshold;
+
+    captured = (type == ENPASSANT) ? PAWN : b->squares[to];
+    piece = (m.prom() != NO_PIECE) ? m.prom() : b->squares[from];
+
+    swap = piecevals[captured][0] - threshold;
+    if (m.prom() != NO_PIECE)
+        swap += piecevals[m.prom()][0] - piecevals[PAWN][0];
+
+    // Even winning the piece for free isn't enough.
+    if (swap < 0)
+        return false;
+
+    // Even losing the moving piece straight back is good enough.
+    swap = piecevals[piece][0] - swap;
+    if (swap <= 0)
+        return true;
+
+    occ = (b->colors[WHITE] | b->colors[BLACK]) ^ (1ULL << from) ^ (1ULL << to);
+
+    if (type == ENPASSANT)
+        occ ^= 1ULL << (b->side == WHITE ? to - 8 : to + 8);
+
+    attackers = AttacksTo(b, to, occ);
+
+    pinned[WHITE] = Pinned(b, WHITE, &pinners[WHITE]);
+    pinned[BLACK] = Pinned(b, BLACK, &pinners[BLACK]);
+
+    stm = b->side;
+    res = 1;
+
+    while (1) {
+        stm ^= 1;
+        attackers &= occ;
+
+        stmattackers = attackers & b->colors[stm];
+
+        // Pinned pieces stay put while their pinner is on the board.
+        if (pinners[stm] & occ)
+            stmattackers &= ~pinned[stm];
+
+        if (!stmattackers)
+            break;
+
+        res ^= 1;
+
+        // Recapture with the least valuable piece, and uncover any
+        // sliders behind it.
+        if ((bb = stmattackers & b->pawns())) {
+            if ((swap = piecevals[PAWN][0] - swap) < res)
+                break;
+            occ ^= bb & -bb;
+            attackers |= BishopAttacks(to, occ) & (b->bishops() | b->queens());
+        } else if ((bb = stmattackers & b->knights())) {
+            if ((swap = piecevals[KNIGHT][0] - swap) < res)
+                break;
+            occ ^= bb & -bb;
+        } else if ((bb = stmattackers & b->bishops())) {
+            if ((swap = piecevals[BISHOP][0] - swap) < res)
+                break;
+            occ ^= bb & -bb;
+            attackers |= BishopAttacks(to, occ) & (b->bishops() | b->queens());
+        } else if ((bb = stmattackers & b->rooks())) {
+            if ((swap = piecevals[ROOK][0] - swap) < res)
+                break;
+            occ ^= bb & -bb;
+            attackers |= RookAttacks(to, occ) & (b->rooks() | b->queens());
+        } else if ((bb = stmattackers & b->queens())) {
+            if ((swap = piecevals[QUEEN][0] - swap) < res)
+                break;
+            occ ^= bb & -bb;
+            attackers |= (BishopAttacks(to, occ) & (b->bishops() | b->queens())) |
+                         (RookAttacks(to, occ) & (b->rooks() | b->queens()));
+        } else {
+            // The king can only recapture if nothing defends the square.
+            return (attackers & ~b->colors[stm]) ? res ^ 1 : res;
+        }
+    }
+
+    return res;
+}
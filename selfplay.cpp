@@ -0,0 +1,274 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Dan Ravensloft <dan.ravensloft@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "board.h"
+#include "functions.h"
+
+// Self-play between two sets of search parameters, to test a change without
+// a GUI or tournament manager. Games run on every thread at once, in pairs
+// from each opening with colours swapped, and a sequential probability
+// ratio test decides as the results come in whether the challenger is
+// better by elo1 (H1) or not better than by elo0 (H0).
+
+#define SELFPLAY_HASH 4 // Megabytes of hash per player
+
+// Error rates of the test.
+#define SPRT_ALPHA 0.05
+#define SPRT_BETA  0.05
+
+struct Match {
+    std::vector<std::string> openings;
+    struct SearchParams players[2]; // The base, then the challenger
+    int nodes, games;
+    std::atomic<int> next;
+    std::atomic<bool> stop;
+    std::mutex lock;
+    int wins, draws, losses;        // The challenger's
+    double elo0, elo1;
+    int starttime;
+};
+
+// Whether this position occurred twice before, with the same side to move
+// and no irreversible move in between.
+static bool Repeated(struct KeyStack * game, struct Board * b)
+{
+    int i, count = 0;
+
+    for (i = game->count - 3; i >= 0 && i >= game->count - 1 - b->fifty; i -= 2) {
+        if (game->keys[i] == b->hash && ++count == 2)
+            return true;
+    }
+
+    return false;
+}
+
+// Play one game, with player white (0 or 1) as white. Returns white's score
+// in half points.
+static int PlayGame(struct Match * match, struct SearchContext * ctx, struct HashTable * tables,
+                    const char * fen, int white)
+{
+    struct Board b;
+    struct KeyStack game;
+    struct Move moves[MAX_MOVES];
+    struct PV pv;
+    struct Undo u;
+    char buf[512];
+    int player;
+
+    snprintf(buf, sizeof(buf), "%s", fen);
+    ParseFEN(&b, buf);
+
+    game.count = 0;
+    game.keys[game.count++] = b.hash;
+
+    for (player = 0; player < 2; player++) {
+        ClearTT(&tables[player]);
+        ClearHistory(&ctx[player]);
+    }
+
+    while (1) {
+        if (!GenerateLegal(&b, moves, 0)) {
+            if (!IsInCheck(&b))
+                return 1;
+
+            return (b.side == WHITE) ? 0 : 2;
+        }
+
+        // Games too long to keep the keys of are drawn as well.
+        if (b.fifty >= 100 || Repeated(&game, &b) || game.count >= MAX_GAME)
+            return 1;
+
+        player = (b.side == WHITE) ? white : !white;
+
+        InitSearch(&ctx[player], &b, &game);
+        StartClockInfinite(&ctx[player].clock);
+
+        ctx[player].params = match->players[player];
+        ctx[player].tt = &tables[player];
+        ctx[player].nodelimit = match->nodes;
+        ctx[player].multipv = 1;
+
+        Think(&ctx[player], 64, &pv, 0);
+
+        // A node limit can run out before the first iteration has a move.
+        if (!pv.count)
+            pv.moves[pv.count++] = moves[0];
+
+        MakeMove(&b, &u, pv.moves[0]);
+        game.keys[game.count++] = b.hash;
+    }
+}
+
+static double ScoreToElo(double score)
+{
+    score = fmin(fmax(score, 1e-6), 1 - 1e-6);
+
+    return -400 * log10(1 / score - 1);
+}
+
+static double EloToScore(double elo)
+{
+    return 1 / (1 + pow(10, -elo / 400));
+}
+
+// The log-likelihood ratio of H1 to H0 for the results so far, using the
+// normal approximation to the trinomial distribution of game scores.
+static double LLR(struct Match * match, double * elo, double * margin)
+{
+    int n = match->wins + match->draws + match->losses;
+    double w = (double)match->wins / n, d = (double)match->draws / n, l = (double)match->losses / n;
+    double score = w + d / 2;
+    double var = w * pow(1 - score, 2) + d * pow(0.5 - score, 2) + l * pow(score, 2);
+    double s0 = EloToScore(match->elo0), s1 = EloToScore(match->elo1);
+    double sigma = sqrt(var / n);
+
+    *elo = ScoreToElo(score);
+    *margin = (ScoreToElo(score + 1.96 * sigma) - ScoreToElo(score - 1.96 * sigma)) / 2;
+
+    if (var <= 0)
+        return 0;
+
+    return n * (s1 - s0) * (2 * score - s0 - s1) / (2 * var);
+}
+
+static void Record(struct Match * match, int score)
+{
+    std::lock_guard<std::mutex> guard(match->lock);
+    double lower = log(SPRT_BETA / (1 - SPRT_ALPHA)), upper = log((1 - SPRT_BETA) / SPRT_ALPHA);
+    double elo, margin, llr, hours;
+    int games;
+
+    if (match->stop)
+        return;
+
+    if (score == 2)
+        match->wins++;
+    else if (score == 1)
+        match->draws++;
+    else
+        match->losses++;
+
+    games = match->wins + match->draws + match->losses;
+    hours = (ReadClock() - match->starttime) / 3600000.0;
+    llr = LLR(match, &elo, &margin);
+
+    printf("Games: %d W: %d D: %d L: %d Elo: %.1f +- %.1f LLR: %.2f [%.2f, %.2f] Games/hour: %.0f\n",
+           games, match->wins, match->draws, match->losses, elo, margin, llr, lower, upper,
+           games / fmax(hours, 1e-9));
+
+    if (llr >= upper || llr <= lower) {
+        printf("# SPRT: %s accepted\n", (llr >= upper) ? "H1" : "H0");
+        match->stop = true;
+    }
+}
+
+static void Worker(struct Match * match)
+{
+    struct SearchContext * ctx = new SearchContext[2];
+    struct HashTable tables[2] = {};
+    int game, white;
+
+    ResizeTT(&tables[0], SELFPLAY_HASH);
+    ResizeTT(&tables[1], SELFPLAY_HASH);
+
+    while (!match->stop && (game = match->next++) < match->games) {
+        // Each opening is played twice, the challenger having white first.
+        white = !(game & 1);
+
+        int score = PlayGame(match, ctx, tables,
+                             match->openings[(game / 2) % match->openings.size()].c_str(), white);
+
+        Record(match, white ? score : 2 - score);
+    }
+
+    FreeTT(&tables[0]);
+    FreeTT(&tables[1]);
+
+    delete[] ctx;
+}
+
+void SelfPlay(const char * path, int games, int threads, int nodes, struct SearchParams * challenger,
+              double elo0, double elo1)
+{
+    static struct Match match;
+    std::vector<std::thread> workers;
+    char line[512];
+    FILE * f = fopen(path, "r");
+    int i;
+
+    if (f == NULL) {
+        printf("Error (cannot open openings): %s\n", path);
+        return;
+    }
+
+    match.openings.clear();
+
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[0] && line[0] != '#')
+            match.openings.push_back(line);
+    }
+
+    fclose(f);
+
+    if (match.openings.empty()) {
+        printf("Error (no openings): %s\n", path);
+        return;
+    }
+
+    match.players[0] = params;
+    match.players[1] = *challenger;
+    match.nodes = nodes;
+    match.games = games;
+    match.next = 0;
+    match.stop = false;
+    match.wins = match.draws = match.losses = 0;
+    match.elo0 = elo0;
+    match.elo1 = elo1;
+    match.starttime = ReadClock();
+
+    printf("# %d games from %zu openings, %d nodes a move, %d threads, SPRT elo0 %.1f elo1 %.1f\n",
+           games, match.openings.size(), nodes, threads, elo0, elo1);
+
+    for (i = 0; i < threads; i++)
+        workers.push_back(std::thread(Worker, &match));
+
+    for (std::thread& t : workers)
+        t.join();
+
+    if (!match.stop)
+        printf("# SPRT: inconclusive after %d games\n", match.wins + match.draws + match.losses);
+}
@@ -0,0 +1,141 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Dan Ravensloft <dan.ravensloft@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "board.h"
+#include "functions.h"
+
+#define GAMELENGTH 40
+
+int moveoverhead = 30;
+
+void StartClock(struct Clock * c, int timeleft, int movestogo, int inc)
+{
+    int maxtime, mtg;
+
+    c->starttime = ReadClock();
+
+    // Never plan to use time we need to send the move.
+    maxtime = max(timeleft - moveoverhead, 1);
+
+    mtg = movestogo ? min(movestogo, GAMELENGTH) : GAMELENGTH;
+
+    c->optimum = min(timeleft / mtg + inc, maxtime);
+
+    // With few moves left we can afford to run over further, but never by
+    // more than a fair share of what is left, so that the moves still to
+    // come keep some time of their own. An increment only comes back after
+    // the move, so don't bank on more of it than a quarter of the clock.
+    c->hardtimelimit = min(c->optimum * 3, maxtime);
+    c->hardtimelimit = min(c->hardtimelimit,
+        timeleft / min(mtg, 4) + min(inc, timeleft / 4));
+    c->hardtimelimit = max(c->hardtimelimit, 1);
+
+    c->optimum = min(c->optimum, c->hardtimelimit);
+    c->timelimit = c->optimum / 2;
+
+    c->lastend = c->lastiter = c->previter = 0;
+    c->stable = 0;
+    c->lastscore = 0;
+    c->lastbest = Move();
+}
+
+void StartClockInfinite(struct Clock * c)
+{
+    c->starttime = ReadClock();
+
+    c->optimum = c->timelimit = c->hardtimelimit = 1 << 30;
+
+    c->lastend = c->lastiter = c->previter = 0;
+    c->stable = 0;
+    c->lastscore = 0;
+    c->lastbest = Move();
+}
+
+// Called after each completed iteration; returns whether to start another.
+bool NextIteration(struct Clock * c, int depth, struct Move best, int score)
+{
+    int elapsed = Elapsed(c);
+    int predicted, soft;
+    float scale = 1.0;
+
+    if (c->optimum == 1 << 30)
+        return true;
+
+    c->previter = c->lastiter;
+    c->lastiter = elapsed - c->lastend;
+    c->lastend = elapsed;
+
+    if (depth > 1 && best == c->lastbest) {
+        c->stable++;
+    } else {
+        c->stable = 0;
+    }
+
+    // A new best move means the search has not settled yet.
+    if (depth > 1 && !c->stable)
+        scale *= 1.5;
+
+    // So does a falling score.
+    if (depth > 1 && score < c->lastscore - 30)
+        scale *= 1.3;
+
+    // A long-unchanged best move is probably right.
+    if (c->stable >= 4)
+        scale *= 0.6;
+
+    c->lastbest = best;
+    c->lastscore = score;
+
+    soft = min(c->timelimit * scale, c->hardtimelimit);
+
+    if (elapsed >= soft)
+        return false;
+
+    // Estimate the cost of the next iteration from the effective branching
+    // factor of this one, and don't start what we cannot finish.
+    if (c->previter > 0) {
+        float ebf = (float)c->lastiter / c->previter;
+
+        ebf = ebf < 1.5 ? 1.5 : (ebf > 6.0 ? 6.0 : ebf);
+
+        predicted = c->lastiter * ebf;
+
+        if (elapsed + predicted >= c->hardtimelimit)
+            return false;
+    }
+
+    return true;
+}
+
+bool HardTimeout(struct Clock * c)
+{
+    return Elapsed(c) >= c->hardtimelimit;
+}
+
+int Elapsed(struct Clock * c)
+{
+    return ReadClock() - c->starttime;
+}
@@ -23,11 +23,20 @@
  */
 
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <vector>
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // WINDOWS
 
 #include "board.h"
 #include "functions.h"
+#include "profile.h"
 
 struct TTE {
     uint64_t hash;
@@ -35,30 +44,165 @@ struct TTE {
     int16_t val;
     uint8_t flags;
     uint8_t depth;
+    uint8_t age;
+};
+
+// A hash file is this header followed by the table itself. The format
+// version, entry size and a Zobrist key have to match for it to load.
+// The generation is the table's when it was saved, which the entries'
+// ages are relative to.
+struct TTHeader {
+    char magic[8];
+    uint32_t entrysize;
+    uint32_t pad;
+    uint64_t entries;
+    uint64_t zobrist;
+    uint8_t generation;
+    char reserved[31];
 };
 
-std::vector< TTE > tt;
+static_assert(sizeof(TTHeader) == 64, "the table must start on a cache line");
 
-void ResizeTT(int megabytes)
+static const char ttmagic[8] = { 'H', 'F', 'H', 'A', 'S', 'H', '0', '2' };
+
+// The table searches use unless they are given their own.
+struct HashTable tt;
+
+void FreeTT(struct HashTable * t)
+{
+#ifndef WINDOWS
+    if (t->mapbase)
+        munmap(t->mapbase, t->maplength);
+    else
+#endif // WINDOWS
+        free(t->entries);
+
+    t->entries = NULL;
+    t->size = 0;
+    t->mapbase = NULL;
+    t->maplength = 0;
+}
+
+void ResizeTT(struct HashTable * t, int megabytes)
 {
     // Convert to bytes
-    size_t s = megabytes * 1024 * 1024;
+    size_t s = (size_t)megabytes * 1024 * 1024;
     s /= sizeof(TTE);
 
-    tt.resize(s);
+    // Entries are found by masking the key, so keep a power of two.
+    while (s & (s - 1))
+        s &= s - 1;
+
+    FreeTT(t);
+
+    t->entries = (struct TTE *)calloc(s, sizeof(TTE));
+    t->size = s;
+}
+
+void ClearTT(struct HashTable * t)
+{
+    memset((void *)t->entries, 0, t->size * sizeof(TTE));
+}
+
+// Start a new search, so that what earlier ones stored may be replaced.
+void AgeTT(struct HashTable * t)
+{
+    t->generation++;
+}
+
+// Write the table out. It goes to a temporary file that then replaces the
+// old one, so a table mapped from that file is never truncated under us.
+bool SaveTT(struct HashTable * t, const char * path)
+{
+    struct TTHeader h;
+    char tmp[512];
+    FILE * f;
+    bool ok;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ttmagic, sizeof(ttmagic));
+    h.entrysize = sizeof(TTE);
+    h.entries = t->size;
+    h.zobrist = zobrist_side;
+    h.generation = t->generation;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    if ((f = fopen(tmp, "wb")) == NULL)
+        return false;
+
+    ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+         fwrite(t->entries, sizeof(TTE), t->size, f) == t->size;
+
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return false;
+    }
+
+    return true;
 }
 
-void ClearTT()
+// Map a saved table in place of the current one. Privately mapped, pages
+// are only copied once the search writes to them, and processes loading
+// the same file share the rest. Mapped shared, writes go back to the file,
+// and processes loading it that way share a single table.
+bool LoadTT(struct HashTable * t, const char * path, bool shared)
 {
-    size_t s = tt.size();
+#ifndef WINDOWS
+    struct TTHeader h;
+    struct stat st;
+    void * base;
+    int fd;
+
+    if ((fd = open(path, shared ? O_RDWR : O_RDONLY)) < 0)
+        return false;
+
+    if (fstat(fd, &st) != 0 || read(fd, &h, sizeof(h)) != sizeof(h) ||
+            memcmp(h.magic, ttmagic, sizeof(ttmagic)) != 0 ||
+            h.entrysize != sizeof(TTE) || h.zobrist != zobrist_side ||
+            h.entries == 0 || (h.entries & (h.entries - 1)) ||
+            (uint64_t)st.st_size != sizeof(h) + h.entries * sizeof(TTE)) {
+        close(fd);
+        return false;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+
+    // The mapping keeps its own reference to the file.
+    close(fd);
 
-    tt.clear();
-    tt.resize(s);
+    if (base == MAP_FAILED)
+        return false;
+
+    FreeTT(t);
+
+    t->mapbase = base;
+    t->maplength = st.st_size;
+    t->entries = (struct TTE *)((char *)base + sizeof(h));
+    t->size = h.entries;
+
+    // Step back a generation, so that the next search counts as the one
+    // that saved the table, and keeps the deep entries it stored.
+    t->generation = h.generation - 1;
+
+    return true;
+#else
+    (void)t;
+    (void)path;
+    (void)shared;
+
+    return false;
+#endif // WINDOWS
 }
 
-int ReadTT(struct Board * b, struct Move * m, int depth, int alpha, int beta, int ply)
+int ReadTT(struct HashTable * t, struct Board * b, struct Move * m, int depth, int alpha, int beta, int ply)
 {
-    struct TTE entry = tt[b->hash & (tt.size()-1)];
+    PROFILE_ZONE(ZONE_READ_TT);
+
+    struct TTE entry = t->entries[b->hash & (t->size-1)];
 
     int val = entry.val;
 
@@ -69,10 +213,7 @@ int ReadTT(struct Board * b, struct Move * m, int depth, int alpha, int beta, in
         val = val + ply;
     }
 
-    m->from = 0;
-    m->dest = 0;
-    m->type = 0;
-    m->score = 0;
+    *m = Move();
 
     if (entry.hash == b->hash) {
 
@@ -90,16 +231,23 @@ int ReadTT(struct Board * b, struct Move * m, int depth, int alpha, int beta, in
             }
         }
         *m = entry.m;
-        m->score = 0;
     }
 
     return 11000;
 }
 
-void WriteTT(struct Board * b, int depth, int val, int hashf, struct Move m, int ply)
+void WriteTT(struct HashTable * t, struct Board * b, int depth, int val, int hashf, struct Move m, int ply)
 {
+    struct TTE * slot = &t->entries[b->hash & (t->size-1)];
     struct TTE entry;
 
+    // Keep a deeper entry of this search, so that the many quiescence and
+    // shallow writes don't push out the costly ones. A new result for the
+    // same position is worth more, as long as it is nearly as deep.
+    if (slot->age == t->generation &&
+            slot->depth > depth + (slot->hash == b->hash ? 2 : 0))
+        return;
+
     if (val >= 9500) {
         val = val + ply;
     }
@@ -112,6 +260,16 @@ void WriteTT(struct Board * b, int depth, int val, int hashf, struct Move m, int
     entry.val = val;
     entry.flags = hashf;
     entry.depth = depth;
+    entry.age = t->generation;
+
+    *slot = entry;
+}
+
+// The stored move for this position regardless of depth or bound, or a null
+// move if there is no entry. It may still be illegal after a key collision.
+struct Move ProbeTTMove(struct HashTable * t, struct Board * b)
+{
+    struct TTE entry = t->entries[b->hash & (t->size-1)];
 
-    tt[b->hash & (tt.size()-1)] = entry;
+    return (entry.hash == b->hash) ? entry.m : Move();
 }
@@ -0,0 +1,424 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Dan Ravensloft <dan.ravensloft@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#include "board.h"
+#include "functions.h"
+
+// Texel tuning of the material and piece-square values. Eval() is linear
+// in them once the phase is known, so each position is reduced to a short
+// list of feature coefficients up front and never looked at again.
+
+#define TUNE_PST      0                    // pst[piece][sq], white's view
+#define TUNE_MATERIAL (TUNE_PST + 6 * 64)  // piecevals[PAWN..QUEEN]
+#define TUNE_TEMPO    (TUNE_MATERIAL + 5)
+#define TUNE_FEATURES (TUNE_TEMPO + 1)
+
+// A feature index in the low 9 bits, its coefficient + 64 in the top 7.
+#define PACK(index, coeff) ((uint16_t)((index) | (((coeff) + 64) << 9)))
+#define INDEX(f)           ((f) & 511)
+#define COEFF(f)           (((f) >> 9) - 64)
+
+static_assert(TUNE_FEATURES <= 512, "feature indices must fit in 9 bits");
+
+struct TunePosition {
+    uint32_t offset; // First feature in the pool
+    uint8_t count;
+    int8_t phase;
+    uint8_t result;  // 0, 1 or 2 half points for white
+};
+
+struct TuneData {
+    std::vector<struct TunePosition> positions;
+    std::vector<uint16_t> features;
+};
+
+// Follow the capture Quies() would play until standing pat is best, so
+// that the eval is fitted to quiet positions. Returns false for positions
+// that end up in check.
+static bool Resolve(struct SearchContext * ctx, struct Board * b)
+{
+    struct KeyStack keys;
+    struct Move moves[MAX_MOVES], best;
+    struct Undo u;
+    int count, i, score, val, bestval;
+    int steps;
+
+    keys.count = 0;
+
+    for (steps = 0; steps < 32; steps++) {
+        if (IsInCheck(b))
+            return false;
+
+        InitSearch(ctx, b, &keys);
+        StartClockInfinite(&ctx->clock);
+
+        score = Quies(ctx, -MATE, MATE, 1, 0);
+
+        if (score <= Eval(b))
+            return true;
+
+        count = GenerateCaptures(b, moves, 0);
+        bestval = -MATE;
+        best = Move();
+
+        for (i = 0; i < count; i++) {
+            MakeMove(b, &u, moves[i]);
+
+            if (!IsIllegal(b)) {
+                InitSearch(ctx, b, &keys);
+                val = -Quies(ctx, -MATE, MATE, 1, 0);
+
+                if (val > bestval) {
+                    bestval = val;
+                    best = moves[i];
+                }
+            }
+
+            UnmakeMove(b, &u, moves[i]);
+        }
+
+        if (best == Move())
+            return true;
+
+        MakeMove(b, &u, best);
+    }
+
+    return true;
+}
+
+static int Phase(struct Board * b)
+{
+    return 24 - cnt(b->pieces[KNIGHT]) - cnt(b->pieces[BISHOP])
+              - (cnt(b->pieces[ROOK]) << 1) - (cnt(b->pieces[QUEEN]) << 2);
+}
+
+static void AddPosition(struct TuneData * data, struct Board * b, int result)
+{
+    int coeffs[TUNE_FEATURES] = {0};
+    struct TunePosition p;
+    uint64_t bb;
+    int piece, i;
+
+    for (piece = PAWN; piece <= KING; piece++) {
+        for (bb = b->pieces[piece] & b->colors[WHITE]; bb; bb &= bb - 1)
+            coeffs[TUNE_PST + piece * 64 + lsb(bb)]++;
+
+        for (bb = b->pieces[piece] & b->colors[BLACK]; bb; bb &= bb - 1)
+            coeffs[TUNE_PST + piece * 64 + (lsb(bb) ^ 56)]--;
+    }
+
+    for (piece = PAWN; piece <= QUEEN; piece++)
+        coeffs[TUNE_MATERIAL + piece] = cnt(b->pieces[piece] & b->colors[WHITE]) -
+                                        cnt(b->pieces[piece] & b->colors[BLACK]);
+
+    coeffs[TUNE_TEMPO] = (b->side == WHITE) ? 1 : -1;
+
+    p.offset = data->features.size();
+    p.count = 0;
+    p.phase = Phase(b);
+    p.result = result;
+
+    for (i = 0; i < TUNE_FEATURES; i++) {
+        if (coeffs[i]) {
+            data->features.push_back(PACK(i, coeffs[i]));
+            p.count++;
+        }
+    }
+
+    data->positions.push_back(p);
+}
+
+// Results are read as "1-0", "0-1" and "1/2-1/2", or as [1.0], [0.5] and [0.0].
+static int ParseResult(const char * line)
+{
+    if (strstr(line, "1/2-1/2") || strstr(line, "[0.5]"))
+        return 1;
+    if (strstr(line, "1-0") || strstr(line, "[1.0]"))
+        return 2;
+    if (strstr(line, "0-1") || strstr(line, "[0.0]"))
+        return 0;
+
+    return -1;
+}
+
+static bool LoadPositions(struct TuneData * data, const char * path)
+{
+    static struct SearchContext ctx;
+    struct Board b;
+    char line[512];
+    int result, skipped = 0;
+    FILE * f = fopen(path, "r");
+
+    if (f == NULL)
+        return false;
+
+    while (fgets(line, sizeof(line), f)) {
+        result = ParseResult(line);
+
+        if (result < 0) {
+            skipped++;
+            continue;
+        }
+
+        ParseFEN(&b, line);
+
+        if (!Resolve(&ctx, &b)) {
+            skipped++;
+            continue;
+        }
+
+        AddPosition(data, &b, result);
+
+        if (!(data->positions.size() % 100000))
+            printf("# %zu positions loaded\n", data->positions.size());
+    }
+
+    fclose(f);
+
+    printf("# %zu positions loaded, %d skipped, %zu bytes of features\n", data->positions.size(),
+           skipped, data->features.size() * sizeof(uint16_t));
+
+    return true;
+}
+
+static inline double Evaluate(const struct TuneData * data, const struct TunePosition * p, const double * values)
+{
+    double mg = 0, eg = 0;
+    int i;
+
+    for (i = 0; i < p->count; i++) {
+        uint16_t f = data->features[p->offset + i];
+        mg += COEFF(f) * values[2 * INDEX(f)];
+        eg += COEFF(f) * values[2 * INDEX(f) + 1];
+    }
+
+    return (mg * p->phase + eg * (24 - p->phase)) / 24;
+}
+
+static inline double Sigmoid(double k, double eval)
+{
+    return 1.0 / (1.0 + pow(10.0, -k * eval / 400.0));
+}
+
+// Mean squared error over a slice of the positions, and its gradient
+// with respect to every parameter if grad isn't NULL.
+static void Slice(const struct TuneData * data, size_t begin, size_t end, const double * values,
+                  double k, double * error, double * grad)
+{
+    size_t n;
+    int i;
+
+    *error = 0;
+
+    for (n = begin; n < end; n++) {
+        const struct TunePosition * p = &data->positions[n];
+        double s = Sigmoid(k, Evaluate(data, p, values));
+        double diff = p->result / 2.0 - s;
+
+        *error += diff * diff;
+
+        if (grad == NULL)
+            continue;
+
+        double d = -2 * diff * s * (1 - s) * k * log(10.0) / 400.0;
+
+        for (i = 0; i < p->count; i++) {
+            uint16_t f = data->features[p->offset + i];
+            grad[2 * INDEX(f)]     += d * COEFF(f) * p->phase / 24.0;
+            grad[2 * INDEX(f) + 1] += d * COEFF(f) * (24 - p->phase) / 24.0;
+        }
+    }
+}
+
+static double Error(const struct TuneData * data, const double * values, double k, int threads, double * grad)
+{
+    std::vector<std::thread> pool;
+    std::vector<double> errors(threads);
+    std::vector< std::vector<double> > grads(threads, std::vector<double>(2 * TUNE_FEATURES, 0.0));
+    size_t size = data->positions.size();
+    double error = 0;
+    int t, i;
+
+    for (t = 0; t < threads; t++) {
+        pool.push_back(std::thread(Slice, data, size * t / threads, size * (t + 1) / threads, values, k,
+                                   &errors[t], grad ? grads[t].data() : NULL));
+    }
+
+    for (t = 0; t < threads; t++) {
+        pool[t].join();
+        error += errors[t];
+
+        if (grad) {
+            for (i = 0; i < 2 * TUNE_FEATURES; i++)
+                grad[i] += grads[t][i] / size;
+        }
+    }
+
+    return error / size;
+}
+
+// The sigmoid scale that best fits the current values, by golden section.
+static double FitK(const struct TuneData * data, const double * values, int threads)
+{
+    const double ratio = (sqrt(5.0) - 1) / 2;
+    double lo = 0.1, hi = 3.0;
+    double a = hi - ratio * (hi - lo), b = lo + ratio * (hi - lo);
+    double ea = Error(data, values, a, threads, NULL), eb = Error(data, values, b, threads, NULL);
+    int i;
+
+    for (i = 0; i < 40; i++) {
+        if (ea < eb) {
+            hi = b; b = a; eb = ea;
+            a = hi - ratio * (hi - lo);
+            ea = Error(data, values, a, threads, NULL);
+        } else {
+            lo = a; a = b; ea = eb;
+            b = lo + ratio * (hi - lo);
+            eb = Error(data, values, b, threads, NULL);
+        }
+    }
+
+    return (lo + hi) / 2;
+}
+
+static void WriteParams(const char * path, const double * values)
+{
+    static const char * names[6] = { "Pawns", "Knights", "Bishops", "Rooks", "Queen", "King" };
+    FILE * f = fopen(path, "w");
+    int piece, phase, sq;
+
+    if (f == NULL) {
+        printf("Error (cannot write): %s\n", path);
+        return;
+    }
+
+    fprintf(f, "const int piecevals[7][2] = { ");
+    for (piece = PAWN; piece <= QUEEN; piece++) {
+        fprintf(f, "{%d, %d}, ", (int)lround(values[2 * (TUNE_MATERIAL + piece)]),
+                (int)lround(values[2 * (TUNE_MATERIAL + piece) + 1]));
+    }
+    fprintf(f, "{20000, 20000}, {0, 0} };\n");
+
+    fprintf(f, "const int pst[6][2][64] = {\n");
+    for (piece = PAWN; piece <= KING; piece++) {
+        fprintf(f, "    { // %s\n", names[piece]);
+
+        for (phase = 0; phase < 2; phase++) {
+            fprintf(f, "        {\n");
+
+            for (sq = 0; sq < 64; sq++) {
+                fprintf(f, "%s%d%s", (sq % 8) ? " " : "            ",
+                        (int)lround(values[2 * (TUNE_PST + piece * 64 + sq) + phase]),
+                        (sq == 63) ? "\n" : (sq % 8 == 7) ? ",\n" : ",");
+            }
+
+            fprintf(f, "        }%s\n", phase ? "" : ",");
+        }
+
+        fprintf(f, "    }%s\n", (piece == KING) ? "" : ",");
+    }
+    fprintf(f, "};\n");
+
+    fprintf(f, "// Tempo: %d %d\n", (int)lround(values[2 * TUNE_TEMPO]), (int)lround(values[2 * TUNE_TEMPO + 1]));
+
+    fclose(f);
+}
+
+// Fit the eval to the game results of a set of positions with Adam, and
+// write the new tables out as source to paste into eval.cpp.
+void Tune(const char * path, int epochs, int threads)
+{
+    static struct TuneData data;
+    std::vector<double> values(2 * TUNE_FEATURES), grad(2 * TUNE_FEATURES);
+    std::vector<double> m(2 * TUNE_FEATURES, 0.0), v(2 * TUNE_FEATURES, 0.0);
+    const double rate = 1.0, beta1 = 0.9, beta2 = 0.999;
+    int saved[2] = { usennue, params.qchecks };
+    double k, error;
+    int piece, sq, epoch, i;
+
+    // Tune the classical eval, and resolve with captures only.
+    usennue = 0;
+    params.qchecks = 0;
+
+    data.positions.clear();
+    data.features.clear();
+
+    if (!LoadPositions(&data, path) || data.positions.empty()) {
+        printf("Error (no positions): %s\n", path);
+        usennue = saved[0];
+        params.qchecks = saved[1];
+        return;
+    }
+
+    for (piece = PAWN; piece <= KING; piece++) {
+        for (sq = 0; sq < 64; sq++) {
+            values[2 * (TUNE_PST + piece * 64 + sq)]     = pst[piece][0][sq];
+            values[2 * (TUNE_PST + piece * 64 + sq) + 1] = pst[piece][1][sq];
+        }
+    }
+
+    for (piece = PAWN; piece <= QUEEN; piece++) {
+        values[2 * (TUNE_MATERIAL + piece)]     = piecevals[piece][0];
+        values[2 * (TUNE_MATERIAL + piece) + 1] = piecevals[piece][1];
+    }
+
+    values[2 * TUNE_TEMPO] = values[2 * TUNE_TEMPO + 1] = 10;
+
+    k = FitK(&data, values.data(), threads);
+
+    printf("# K = %.4f, error %.6f, %d threads\n", k, Error(&data, values.data(), k, threads, NULL), threads);
+
+    for (epoch = 1; epoch <= epochs; epoch++) {
+        std::fill(grad.begin(), grad.end(), 0.0);
+
+        error = Error(&data, values.data(), k, threads, grad.data());
+
+        for (i = 0; i < 2 * TUNE_FEATURES; i++) {
+            m[i] = beta1 * m[i] + (1 - beta1) * grad[i];
+            v[i] = beta2 * v[i] + (1 - beta2) * grad[i] * grad[i];
+
+            values[i] -= rate * (m[i] / (1 - pow(beta1, epoch))) /
+                         (sqrt(v[i] / (1 - pow(beta2, epoch))) + 1e-8);
+        }
+
+        if (!(epoch % 10) || epoch == epochs)
+            printf("# epoch %d error %.6f\n", epoch, error);
+    }
+
+    WriteParams("tuned-eval.txt", values.data());
+
+    printf("# tuned values written to tuned-eval.txt\n");
+
+    usennue = saved[0];
+    params.qchecks = saved[1];
+}